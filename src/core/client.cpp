@@ -11,15 +11,52 @@
 //===----------------------------------------------------------------------===//
 
 #include "client.h"
+#include "datagram.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <poll.h>
 #include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 namespace core {
 
+namespace {
+
+/// \brief Split the first space-separated word off a line.
+///
+/// \param rest Remainder of the line, advanced past the word and one space.
+/// \return The word.
+std::string_view next_word(std::string_view &rest) noexcept {
+    std::string_view word = rest.substr(0, rest.find_first_of(" \r\n"));
+    rest.remove_prefix(std::min(word.size() + 1, rest.size()));
+    return word;
+}
+
+/// \brief Parse a decimal sequence number.
+///
+/// \param text The number.
+/// \param sequence Receives the number.
+/// \return True if the text is a number.
+bool parse_sequence(std::string_view text, std::uint64_t &sequence) noexcept {
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), sequence);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+} // namespace
+
 Client::Client(const std::string_view server_address,
-               std::uint16_t          server_port) {
+               std::uint16_t          server_port)
+    : unacked_(0) {
     this->socket_ = Socket::create_tcp_socket();
     struct sockaddr_in server_addr{};
     server_addr.sin_family = AF_INET;
@@ -35,20 +72,7 @@ Client::Client(const std::string_view server_address,
 }
 
 void Client::run_interactive() {
-    this->reader_thread_ = std::thread([this]() {
-        try {
-            while (true) {
-                std::string message = this->socket_.recv_line();
-                if (message.empty()) {
-                    break; // Server disconnected
-                }
-
-                std::printf("%s", message.c_str());
-            }
-        } catch (const std::exception &e) {
-            std::fprintf(stderr, "[-] reader_thread: %s\n", e.what());
-        }
-    });
+    start_reader();
 
     std::string input;
     while (std::getline(std::cin, input)) {
@@ -57,7 +81,7 @@ void Client::run_interactive() {
         }
 
         input.push_back('\n');
-        if (this->socket_.send_all(input) < 0) {
+        if (send_lines(input) < 0) {
             std::fprintf(stderr, "[-] Failed to send message to server.\n");
             break;
         }
@@ -69,4 +93,256 @@ void Client::run_interactive() {
     }
 }
 
+void Client::run_pipe() {
+    start_reader();
+
+    // One spare byte so a final unterminated line can always get its newline.
+    std::vector<char> buffer(PIPE_BLOCK_SIZE + 1);
+    std::size_t       filled     = 0;
+    std::size_t       total_sent = 0;
+    std::size_t       lines_sent = 0;
+    bool              eof        = false;
+
+    while (!eof) {
+        ssize_t bytes_read = ::read(
+            STDIN_FILENO, buffer.data() + filled, PIPE_BLOCK_SIZE - filled);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            std::fprintf(
+                stderr, "[-] run_pipe: read: %s\n", std::strerror(errno));
+            break;
+        }
+
+        eof = (bytes_read == 0);
+        filled += static_cast<std::size_t>(bytes_read);
+
+        // Keep reading while more input is immediately available, so that
+        // small pipe reads are coalesced into a single large write.
+        struct pollfd pfd{STDIN_FILENO, POLLIN, 0};
+        if (!eof && filled < PIPE_FLUSH_SIZE && ::poll(&pfd, 1, 0) > 0) {
+            continue;
+        }
+
+        // Only send complete lines, unless a single line fills the buffer.
+        std::size_t send_len = filled;
+        if (eof) {
+            if (filled > 0 && buffer[filled - 1] != '\n') {
+                buffer[filled++] = '\n';
+                send_len         = filled;
+            }
+        } else if (const void *last_nl =
+                       ::memrchr(buffer.data(), '\n', filled)) {
+            send_len = static_cast<std::size_t>(
+                static_cast<const char *>(last_nl) - buffer.data() + 1);
+        } else if (filled < PIPE_BLOCK_SIZE) {
+            continue;
+        }
+
+        if (send_len == 0) {
+            continue;
+        }
+
+        const char *pos = buffer.data();
+        const char *end = pos + send_len;
+        while ((pos = static_cast<const char *>(std::memchr(
+                    pos, '\n', static_cast<std::size_t>(end - pos))))) {
+            ++lines_sent;
+            ++pos;
+        }
+
+        try {
+            send_lines(std::string_view(buffer.data(), send_len));
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "[-] run_pipe: %s\n", e.what());
+            break;
+        }
+
+        total_sent += send_len;
+        filled -= send_len;
+        std::memmove(buffer.data(), buffer.data() + send_len, filled);
+    }
+
+    // Half-close so the server sees end of stream once it has consumed every
+    // line; its closing of the connection acknowledges the whole batch.
+    ::shutdown(this->socket_.sock_fd(), SHUT_WR);
+    if (this->reader_thread_.joinable()) {
+        this->reader_thread_.join();
+    }
+
+    std::fprintf(
+        stderr, "[*] Sent %zu lines (%zu bytes)\n", lines_sent, total_sent);
+}
+
+void Client::run_multicast(const std::string_view group,
+                           std::uint16_t          port,
+                           const std::string_view interface_ip) {
+    Socket      socket = multicast_join(group, port, interface_ip);
+    std::string buffer(MAX_DATAGRAM_SIZE, '\0');
+
+    // Highest sequence number received on each channel.
+    std::unordered_map<std::string, std::uint64_t> last_sequences;
+
+    while (true) {
+        ssize_t bytes_received =
+            ::recv(socket.sock_fd(), buffer.data(), buffer.size(), 0);
+        if (bytes_received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw std::runtime_error(std::string("run_multicast: recv: ") +
+                                     std::strerror(errno));
+        }
+
+        std::uint64_t    sequence;
+        std::string_view message;
+        if (!parse_datagram(
+                std::string_view(buffer.data(),
+                                 static_cast<std::size_t>(bytes_received)),
+                sequence,
+                message)) {
+            continue; // Not one of ours
+        }
+
+        // Messages are "/pub <channel> ...", numbered per channel.
+        std::string_view channel = message.substr(message.find(' ') + 1);
+        channel = channel.substr(0, channel.find_first_of(" \r\n"));
+
+        std::uint64_t &last = last_sequences[std::string(channel)];
+        if (last != 0 && sequence > last + 1) {
+            std::fprintf(stderr,
+                         "[-] Lost %llu messages on %.*s\n",
+                         static_cast<unsigned long long>(sequence - last - 1),
+                         static_cast<int>(channel.size()),
+                         channel.data());
+        }
+
+        last = std::max(last, sequence);
+        std::fwrite(message.data(), 1, message.size(), stdout);
+    }
+}
+
+void Client::start_reader() {
+    this->reader_thread_ = std::thread([this]() {
+        try {
+            std::string message;
+            while (true) {
+                if (!this->socket_.pop_line(message)) {
+                    // Everything received so far is handled; acknowledge it
+                    // unless more arrives shortly, to be acknowledged along.
+                    struct pollfd pfd{this->socket_.sock_fd(), POLLIN, 0};
+                    if (this->unacked_ > 0 &&
+                        ::poll(&pfd, 1, ACK_DELAY_MS) == 0) {
+                        send_acks();
+                    }
+
+                    if (this->socket_.recv_some() <= 0) {
+                        break; // Server disconnected
+                    }
+
+                    continue;
+                }
+
+                std::string_view output(message);
+                if (output.starts_with("/seq ") ||
+                    output.starts_with("/lost ")) {
+                    output = receive_sequenced(output);
+                    if (this->unacked_ >= ACK_BATCH) {
+                        send_acks();
+                    }
+                }
+
+                std::fwrite(output.data(), 1, output.size(), stdout);
+            }
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "[-] reader_thread: %s\n", e.what());
+        }
+    });
+}
+
+std::string_view Client::receive_sequenced(const std::string_view line) {
+    std::string_view rest    = line;
+    std::string_view command = next_word(rest);
+    std::string_view channel = next_word(rest);
+    std::uint64_t    sequence;
+    if (channel.empty() || !parse_sequence(next_word(rest), sequence)) {
+        return std::string_view();
+    }
+
+    Stream &stream = this->streams_[std::string(channel)];
+    if (command == "/lost") {
+        std::uint64_t last;
+        if (!parse_sequence(next_word(rest), last) || last < sequence) {
+            return std::string_view();
+        }
+
+        std::fprintf(stderr,
+                     "[-] Lost %llu messages on %.*s\n",
+                     static_cast<unsigned long long>(last - sequence + 1),
+                     static_cast<int>(channel.size()),
+                     channel.data());
+        stream.expected  = std::max(stream.expected, last + 1);
+        stream.requested = 0;
+        return std::string_view();
+    }
+
+    // Numbering starts with the first message received after joining.
+    if (stream.expected == 0) {
+        stream.expected = sequence;
+        stream.acked    = sequence - 1;
+    }
+
+    if (sequence < stream.expected) {
+        return std::string_view(); // Sent again, and already printed
+    }
+
+    // Later messages are dropped until the missing ones have been sent
+    // again, which the server does from the first missing one on.
+    if (sequence > stream.expected) {
+        if (stream.requested != stream.expected) {
+            std::fprintf(stderr,
+                         "[-] Gap on %.*s: expected %llu, got %llu\n",
+                         static_cast<int>(channel.size()),
+                         channel.data(),
+                         static_cast<unsigned long long>(stream.expected),
+                         static_cast<unsigned long long>(sequence));
+            stream.requested = stream.expected;
+            send_lines("/resend " + std::string(channel) + " " +
+                       std::to_string(stream.expected) + "\n");
+        }
+
+        return std::string_view();
+    }
+
+    ++stream.expected;
+    stream.requested = 0;
+    ++this->unacked_;
+    return rest;
+}
+
+void Client::send_acks() {
+    // One cumulative acknowledgement per channel covers the whole batch.
+    std::string acks;
+    for (auto &[channel, stream] : this->streams_) {
+        if (stream.expected > 0 && stream.acked + 1 < stream.expected) {
+            stream.acked = stream.expected - 1;
+            acks += "/ack " + channel + " " + std::to_string(stream.acked) +
+                    "\n";
+        }
+    }
+
+    this->unacked_ = 0;
+    if (!acks.empty()) {
+        send_lines(acks);
+    }
+}
+
+ssize_t Client::send_lines(const std::string_view data) {
+    std::lock_guard<std::mutex> lock(this->send_mutex_);
+    return this->socket_.send_all(data);
+}
+
 } // namespace core
@@ -15,10 +15,21 @@
 
 #include "socket.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 
 namespace core {
 
+/// \brief Connection to a server, printing every message it receives.
+///
+/// Messages of reliable channels are delivered in sequence order, once
+/// each: duplicates are dropped, a gap makes the client ask for the missing
+/// messages again, and what was received is acknowledged in batches.
 class Client {
   public:
     /// \brief Constructor for Client class.
@@ -30,11 +41,82 @@ class Client {
                     std::uint16_t          server_port);
     Client() = delete;
 
+    /// \brief Run the client reading messages line by line from stdin.
+    ///
+    /// Typing "/quit" closes the connection.
     void run_interactive();
 
+    /// \brief Run the client forwarding stdin to the server in bulk.
+    ///
+    /// Stdin is read in large blocks and sent in coalesced writes that always
+    /// end on a line boundary. Server output is drained asynchronously, and the
+    /// call returns once the server has closed the connection after consuming
+    /// everything that was sent.
+    void run_pipe();
+
+    /// \brief Print the messages a server publishes to a multicast group.
+    ///
+    /// No connection to the server is needed. Sequence numbers are tracked
+    /// per channel, and lost messages are reported on stderr.
+    ///
+    /// \param group IPv4 multicast group address.
+    /// \param port Port the group is sent to.
+    /// \param interface_ip Address of the interface to join on (empty to let
+    /// the kernel choose).
+    /// \throws std::runtime_error if the group cannot be joined or receiving
+    /// fails.
+    static void run_multicast(const std::string_view group,
+                              std::uint16_t          port,
+                              const std::string_view interface_ip);
+
   private:
-    Socket      socket_;
-    std::thread reader_thread_;
+    /// \brief Size of the stdin buffer used by run_pipe().
+    static constexpr std::size_t PIPE_BLOCK_SIZE = 1024 * 1024;
+
+    /// \brief Amount of buffered input that triggers a write in run_pipe().
+    static constexpr std::size_t PIPE_FLUSH_SIZE = 256 * 1024;
+
+    /// \brief Messages of reliable channels received between two
+    /// acknowledgements, when they arrive without pause.
+    static constexpr std::size_t ACK_BATCH = 256;
+
+    /// \brief Time in milliseconds the reader waits for more messages before
+    /// acknowledging those it has received.
+    static constexpr int ACK_DELAY_MS = 20;
+
+    /// \brief Receiving state of a reliable channel.
+    struct Stream {
+        std::uint64_t expected  = 0; ///< Next sequence number (0 if unknown).
+        std::uint64_t acked     = 0; ///< Last sequence number acknowledged.
+        std::uint64_t requested = 0; ///< Sequence number asked for again.
+    };
+
+    /// \brief Start the thread printing messages received from the server.
+    void start_reader();
+
+    /// \brief Handle a "/seq <channel> <sequence> <message>" or "/lost
+    /// <channel> <first> <last>" line from the server. Reader thread only.
+    ///
+    /// \param line The line.
+    /// \return The message to print, or an empty view if there is none.
+    std::string_view receive_sequenced(const std::string_view line);
+
+    /// \brief Acknowledge every message received on reliable channels.
+    /// Reader thread only.
+    void send_acks();
+
+    /// \brief Send data to the server from any thread.
+    ///
+    /// \param data The data, made of complete lines.
+    /// \return Result of Socket::send_all().
+    /// \throws std::runtime_error if sending fails.
+    ssize_t send_lines(const std::string_view data);
+
+    Socket                                  socket_;
+    std::thread                             reader_thread_;
+    std::mutex                              send_mutex_;
+    std::unordered_map<std::string, Stream> streams_;
+    std::size_t                             unacked_;
 };
 
 } // namespace core
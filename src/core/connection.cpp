@@ -0,0 +1,437 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file connection.cpp
+/// Server-side client connection with prioritized outbound lanes.
+///
+//===----------------------------------------------------------------------===//
+
+#include "connection.h"
+#include "tracer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace core {
+
+namespace {
+
+/// \brief Longest time a closing connection waits for zero-copy completions.
+constexpr int ZEROCOPY_DRAIN_MS = 100;
+
+} // namespace
+
+Connection::Connection(Socket                        socket,
+                       const LaneWeights            &weights,
+                       std::size_t                   zerocopy_threshold,
+                       std::shared_ptr<MemoryBudget> budget,
+                       std::size_t                   memory_limit)
+    : socket_(std::move(socket)), wake_fd_(-1), weights_(weights),
+      credits_(weights), head_offset_(0), is_failed_(false),
+      is_wake_signalled_(false), zerocopy_threshold_(zerocopy_threshold),
+      zerocopy_next_(0), memory_(std::move(budget)),
+      memory_limit_(memory_limit), queued_bytes_(0), is_shed_(false) {
+    this->wake_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (this->wake_fd_ < 0) {
+        throw std::runtime_error(std::string("connection: eventfd: ") +
+                                 std::strerror(errno));
+    }
+
+    // Kernels without SO_ZEROCOPY (before 4.14) just keep copying.
+    int enable = 1;
+    if (this->zerocopy_threshold_ > 0 &&
+        ::setsockopt(this->socket_.sock_fd(),
+                     SOL_SOCKET,
+                     SO_ZEROCOPY,
+                     &enable,
+                     sizeof(enable)) < 0) {
+        this->zerocopy_threshold_ = 0;
+    }
+}
+
+Connection::~Connection() {
+    // Freeing a frame the kernel has not finished sending would let the
+    // allocator overwrite bytes still queued on the socket.
+    int waited_ms = 0;
+    while (!this->zerocopy_pending_.empty() && this->socket_.sock_fd() >= 0 &&
+           waited_ms < ZEROCOPY_DRAIN_MS) {
+        struct pollfd pfd{this->socket_.sock_fd(), 0, 0};
+        ::poll(&pfd, 1, 10);
+        waited_ms += 10;
+        reap_zerocopy();
+    }
+
+    if (this->wake_fd_ >= 0) {
+        ::close(this->wake_fd_);
+    }
+}
+
+Socket &Connection::socket() noexcept { return this->socket_; }
+
+int Connection::sock_fd() const noexcept { return this->socket_.sock_fd(); }
+
+int Connection::wake_fd() const noexcept { return this->wake_fd_; }
+
+MemoryAccount &Connection::memory() noexcept { return this->memory_; }
+
+void Connection::account_read(std::size_t bytes) noexcept {
+    this->memory_.set(MemoryKind::READ, bytes);
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    enforce_limit_locked();
+}
+
+void Connection::shed() noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    shed_locked();
+}
+
+bool Connection::was_shed() const noexcept {
+    return this->is_shed_.load(std::memory_order_relaxed);
+}
+
+void Connection::send(Lane lane, Frame frame) {
+    send(lane, std::move(frame), std::string_view());
+}
+
+void Connection::send(Lane             lane,
+                      Frame            frame,
+                      std::string_view key,
+                      std::uint64_t    trace_id) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->is_failed_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    if (!key.empty()) {
+        auto it = this->conflated_.find(key);
+        if (it != this->conflated_.end()) {
+            // The older frame has not been sent, so the socket is backed up
+            // and this thread has nothing to flush. Deque elements never
+            // move, so the pointer is still valid.
+            QueuedFrame *queued = it->second;
+            this->conflated_.erase(it);
+            this->memory_.charge(MemoryKind::OUTBOUND, frame->size());
+            this->memory_.release(MemoryKind::OUTBOUND, queued->frame->size());
+            this->queued_bytes_ += frame->size();
+            this->queued_bytes_ -= queued->frame->size();
+            queued->frame    = std::move(frame);
+            queued->key      = key;
+            queued->trace_id = trace_id;
+            this->conflated_.emplace(key, queued);
+            if (trace_id != 0) {
+                Tracer::record(trace_id, TraceStage::ENQUEUED, sock_fd());
+            }
+
+            enforce_limit_locked();
+            return;
+        }
+    }
+
+    this->memory_.charge(MemoryKind::OUTBOUND, frame->size());
+    this->queued_bytes_ += frame->size();
+
+    auto &queue = this->lanes_[static_cast<std::size_t>(lane)];
+    queue.push_back({std::move(frame), key, trace_id});
+    if (!key.empty()) {
+        this->conflated_.emplace(key, &queue.back());
+    }
+
+    if (trace_id != 0) {
+        Tracer::record(trace_id, TraceStage::ENQUEUED, sock_fd());
+    }
+
+    // Only the first frame left behind needs to wake the connection's
+    // thread; it keeps polling for POLLOUT until the backlog is gone.
+    if (flush_locked() && !this->is_wake_signalled_) {
+        this->is_wake_signalled_ = true;
+        ::eventfd_write(this->wake_fd_, 1);
+    }
+
+    enforce_limit_locked();
+}
+
+bool Connection::flush() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return flush_locked();
+}
+
+bool Connection::has_pending() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (!this->committed_.empty()) {
+        return true;
+    }
+
+    for (const auto &lane : this->lanes_) {
+        if (!lane.empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Connection::has_failed() const noexcept {
+    return this->is_failed_.load(std::memory_order_relaxed);
+}
+
+void Connection::reap_zerocopy() noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    reap_zerocopy_locked();
+}
+
+void Connection::clear_wake() noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    eventfd_t value;
+    ::eventfd_read(this->wake_fd_, &value);
+    this->is_wake_signalled_ = false;
+}
+
+std::string Connection::take_pending() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    std::string                 pending;
+
+    std::size_t offset = this->head_offset_;
+    for (const QueuedFrame &queued : this->committed_) {
+        pending.append(*queued.frame, offset);
+        offset = 0;
+    }
+
+    for (auto &lane : this->lanes_) {
+        for (const QueuedFrame &queued : lane) {
+            pending.append(*queued.frame);
+        }
+
+        lane.clear();
+    }
+
+    this->conflated_.clear();
+    this->committed_.clear();
+    this->head_offset_ = 0;
+    this->memory_.release(MemoryKind::OUTBOUND, this->queued_bytes_);
+    this->queued_bytes_ = 0;
+    return pending;
+}
+
+void Connection::restore_pending(std::string data) {
+    if (data.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->memory_.charge(MemoryKind::OUTBOUND, data.size());
+    this->queued_bytes_ += data.size();
+    this->committed_.push_front(
+        {std::make_shared<const std::string>(std::move(data)), {}, 0});
+    this->head_offset_ = 0;
+}
+
+void Connection::select_frames() {
+    std::size_t bytes = 0;
+
+    while (this->committed_.size() < BATCH_FRAMES && bytes < BATCH_BYTES) {
+        // Always restart from the highest-priority lane with credit left, so
+        // control frames overtake anything not yet committed.
+        bool selected = false;
+        bool queued   = false;
+        for (std::size_t i = 0; i < LANE_COUNT; ++i) {
+            auto &lane = this->lanes_[i];
+            queued     = queued || !lane.empty();
+            if (lane.empty() || this->credits_[i] == 0) {
+                continue;
+            }
+
+            QueuedFrame &front = lane.front();
+            if (!front.key.empty()) {
+                this->conflated_.erase(front.key);
+            }
+
+            bytes += front.frame->size();
+            this->committed_.push_back(std::move(front));
+            lane.pop_front();
+            --this->credits_[i];
+            selected = true;
+            break;
+        }
+
+        if (!queued) {
+            break;
+        }
+
+        if (!selected) {
+            this->credits_ = this->weights_; // Start a new round
+        }
+    }
+}
+
+void Connection::reap_zerocopy_locked() noexcept {
+    while (!this->zerocopy_pending_.empty()) {
+        alignas(struct cmsghdr) char control[CMSG_SPACE(
+            sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+        struct msghdr msg{};
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (::recvmsg(this->socket_.sock_fd(),
+                      &msg,
+                      MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return; // Nothing left to read
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+             cmsg                 = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+
+            struct sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // The kernel copied anyway, e.g. over loopback: pinning pages
+            // only adds cost on this socket from now on.
+            if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0) {
+                this->zerocopy_threshold_ = 0;
+            }
+
+            // Sends [ee_info, ee_data] completed; the range may wrap.
+            std::uint32_t first = err.ee_info;
+            std::uint32_t count = err.ee_data - first;
+            std::erase_if(this->zerocopy_pending_, [&](const auto &pending) {
+                return pending.first - first <= count;
+            });
+        }
+    }
+}
+
+bool Connection::flush_locked() {
+    while (!this->is_failed_.load(std::memory_order_relaxed)) {
+        if (this->committed_.empty()) {
+            select_frames();
+            if (this->committed_.empty()) {
+                return false;
+            }
+        }
+
+        struct iovec iov[BATCH_FRAMES];
+        std::size_t  iov_count = 0;
+        bool         zerocopy  = false;
+        for (const QueuedFrame &queued : this->committed_) {
+            if (iov_count == BATCH_FRAMES) {
+                break;
+            }
+
+            // A large frame is sent on its own with MSG_ZEROCOPY; for small
+            // ones pinning pages and reaping completions costs more than
+            // the copy.
+            const std::string &frame = *queued.frame;
+            bool large = this->zerocopy_threshold_ > 0 &&
+                         frame.size() >= this->zerocopy_threshold_;
+            if (large && iov_count > 0) {
+                break;
+            }
+
+            std::size_t offset = iov_count == 0 ? this->head_offset_ : 0;
+            iov[iov_count++]   = {const_cast<char *>(frame.data()) + offset,
+                                  frame.size() - offset};
+            if (large) {
+                zerocopy = true;
+                break;
+            }
+        }
+
+        struct msghdr msg{};
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = iov_count;
+
+        int     flags = MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0);
+        ssize_t bytes_sent = ::sendmsg(this->socket_.sock_fd(), &msg, flags);
+        if (bytes_sent < 0 && zerocopy && errno == ENOBUFS) {
+            // Out of memory for pinning (optmem_max): copy this one.
+            bytes_sent =
+                ::sendmsg(this->socket_.sock_fd(), &msg, MSG_NOSIGNAL);
+        } else if (bytes_sent >= 0 && zerocopy) {
+            // The kernel numbers zero-copy sends per socket, and reports
+            // them as completed on the error queue; the frame must live
+            // until then, whatever happens to the queue meanwhile.
+            const Frame &frame = this->committed_.front().frame;
+            this->zerocopy_pending_.emplace_back(this->zerocopy_next_++, frame);
+        }
+
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (Socket::would_block(errno)) {
+                return true;
+            }
+
+            // The connection's thread notices through wake_fd and closes it.
+            this->is_failed_.store(true, std::memory_order_relaxed);
+            ::eventfd_write(this->wake_fd_, 1);
+            return false;
+        }
+
+        auto left = static_cast<std::size_t>(bytes_sent);
+        while (!this->committed_.empty()) {
+            const QueuedFrame &head = this->committed_.front();
+            std::size_t        head_left =
+                head.frame->size() - this->head_offset_;
+            if (left < head_left) {
+                this->head_offset_ += left;
+                break;
+            }
+
+            if (head.trace_id != 0) {
+                Tracer::record(head.trace_id, TraceStage::WRITTEN, sock_fd());
+            }
+
+            left -= head_left;
+            this->memory_.release(MemoryKind::OUTBOUND, head.frame->size());
+            this->queued_bytes_ -= head.frame->size();
+            this->committed_.pop_front();
+            this->head_offset_ = 0;
+        }
+    }
+
+    return false;
+}
+
+void Connection::shed_locked() noexcept {
+    for (auto &lane : this->lanes_) {
+        lane.clear();
+    }
+
+    this->conflated_.clear();
+    this->committed_.clear();
+    this->head_offset_ = 0;
+    this->memory_.release(MemoryKind::OUTBOUND, this->queued_bytes_);
+    this->queued_bytes_ = 0;
+    this->is_shed_.store(true, std::memory_order_relaxed);
+
+    // The connection's thread notices through wake_fd and closes it.
+    if (!this->is_failed_.exchange(true, std::memory_order_relaxed)) {
+        ::eventfd_write(this->wake_fd_, 1);
+    }
+}
+
+void Connection::enforce_limit_locked() noexcept {
+    if (this->memory_limit_ > 0 && this->memory_.used() > this->memory_limit_) {
+        shed_locked();
+    }
+}
+
+} // namespace core
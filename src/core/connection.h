@@ -0,0 +1,232 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file connection.h
+/// Server-side client connection with prioritized outbound lanes.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_CONNECTION_H
+#define NOHUB_CORE_CONNECTION_H
+
+#include "memory_budget.h"
+#include "socket.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace core {
+
+/// \brief Priority class of an outbound message.
+enum class Lane : std::uint8_t {
+    CONTROL = 0, ///< Ping replies and server notices, never large.
+    NORMAL  = 1, ///< Regular messages.
+    BULK    = 2, ///< Large payloads.
+};
+
+/// \brief Number of outbound lanes.
+constexpr std::size_t LANE_COUNT = 3;
+
+/// \brief Frames sent from each lane per scheduling round, by lane.
+using LaneWeights = std::array<unsigned, LANE_COUNT>;
+
+/// \brief Message frame shared by every recipient it is queued for.
+using Frame = std::shared_ptr<const std::string>;
+
+class Connection {
+  public:
+    /// \brief Constructor for Connection class.
+    ///
+    /// \param socket Connected client socket, which must be non-blocking.
+    /// \param weights Frames sent from each lane per scheduling round.
+    /// \param zerocopy_threshold Size in bytes from which frames are sent
+    /// with MSG_ZEROCOPY (0 to always copy).
+    /// \param budget Server-wide budget the connection's memory counts
+    /// against (nullptr for none).
+    /// \param memory_limit Bytes the connection may hold before it is shed
+    /// (0 for no limit).
+    /// \throws std::runtime_error if the wakeup descriptor cannot be created.
+    explicit Connection(Socket                        socket,
+                        const LaneWeights            &weights,
+                        std::size_t                   zerocopy_threshold = 0,
+                        std::shared_ptr<MemoryBudget> budget       = nullptr,
+                        std::size_t                   memory_limit = 0);
+    Connection() = delete;
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    Connection(const Connection &)            = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    /// \brief Destructor for Connection class.
+    ///
+    /// Waits briefly for outstanding zero-copy sends, whose frames the
+    /// kernel may still be reading.
+    ~Connection();
+
+    /// \brief Get the client socket, for reading by the connection's thread.
+    ///
+    /// \return Reference to the client socket.
+    Socket &socket() noexcept;
+
+    /// \brief Get the client socket file descriptor.
+    ///
+    /// \return Socket file descriptor.
+    int sock_fd() const noexcept;
+
+    /// \brief Get the descriptor that becomes readable when the connection's
+    /// thread must wait for the socket to be writable, or when sending failed.
+    ///
+    /// \return Eventfd file descriptor.
+    int wake_fd() const noexcept;
+
+    /// \brief Get the memory held on behalf of the client.
+    ///
+    /// \return The connection's memory account.
+    MemoryAccount &memory() noexcept;
+
+    /// \brief Record the size of the client's receive buffers, shedding the
+    /// connection if it now holds more than its memory limit.
+    ///
+    /// \param bytes Size of the buffers.
+    void account_read(std::size_t bytes) noexcept;
+
+    /// \brief Drop everything queued for the client and mark the connection
+    /// as failed, so that its thread closes it.
+    void shed() noexcept;
+
+    /// \brief Check whether the connection was shed to free memory.
+    ///
+    /// \return True if shed() was called or the memory limit was exceeded.
+    bool was_shed() const noexcept;
+
+    /// \brief Queue a frame and send as much queued data as possible.
+    ///
+    /// Never blocks on the socket. Whatever does not fit in the socket buffer
+    /// stays queued and wake_fd() is signalled. If the connection then holds
+    /// more than its memory limit, it is shed instead.
+    ///
+    /// \param lane Priority class of the frame.
+    /// \param frame Frame to send.
+    void send(Lane lane, Frame frame);
+
+    /// \brief Queue a frame that supersedes any frame with the same key still
+    /// waiting in a lane, and send as much queued data as possible.
+    ///
+    /// A superseded frame is replaced in place, keeping its position, so a
+    /// backed-up client receives one frame per key instead of every update.
+    ///
+    /// \param lane Priority class of the frame.
+    /// \param frame Frame to send.
+    /// \param key Conflation key, viewing the frame's own data (empty to
+    /// queue the frame unconditionally).
+    /// \param trace_id Tracer identifier of the message, or 0.
+    void send(Lane             lane,
+              Frame            frame,
+              std::string_view key,
+              std::uint64_t    trace_id = 0);
+
+    /// \brief Send as much queued data as the socket accepts.
+    ///
+    /// \return True if data is still queued.
+    bool flush();
+
+    /// \brief Check whether data is waiting to be sent.
+    ///
+    /// \return True if data is queued.
+    bool has_pending();
+
+    /// \brief Check whether sending to the client failed.
+    ///
+    /// \return True if the connection is broken.
+    bool has_failed() const noexcept;
+
+    /// \brief Release the frames of completed zero-copy sends.
+    ///
+    /// Completions are read from the socket error queue, which makes the
+    /// socket report POLLERR until they are consumed.
+    void reap_zerocopy() noexcept;
+
+    /// \brief Consume a pending wakeup signal.
+    void clear_wake() noexcept;
+
+    /// \brief Remove and return every queued byte, in wire order.
+    ///
+    /// \return The queued data.
+    std::string take_pending();
+
+    /// \brief Queue data ahead of every lane, e.g. output inherited from a
+    /// previous server process.
+    ///
+    /// \param data Data to send first.
+    void restore_pending(std::string data);
+
+  private:
+    /// \brief Frame waiting in a lane.
+    struct QueuedFrame {
+        Frame            frame;
+        std::string_view key;
+        std::uint64_t    trace_id;
+    };
+
+    /// Largest number of frames handed to the kernel in one call.
+    static constexpr std::size_t BATCH_FRAMES = 64;
+
+    /// Bytes after which no more frames are added to a batch, which bounds
+    /// how long a high-priority frame waits behind bulk data.
+    static constexpr std::size_t BATCH_BYTES = 256 * 1024;
+
+    /// Move frames from the lanes to the committed batch, in weighted
+    /// round-robin order with higher-priority lanes served first.
+    void select_frames();
+
+    /// Read zero-copy completions. Requires mutex_ to be held.
+    void reap_zerocopy_locked() noexcept;
+
+    /// Send queued data. Requires mutex_ to be held.
+    ///
+    /// \return True if data is still queued.
+    bool flush_locked();
+
+    /// Shed the connection. Requires mutex_ to be held.
+    void shed_locked() noexcept;
+
+    /// Shed the connection if it holds more than its memory limit. Requires
+    /// mutex_ to be held.
+    void enforce_limit_locked() noexcept;
+
+    Socket                                              socket_;
+    int                                                 wake_fd_;
+    std::mutex                                          mutex_;
+    std::array<std::deque<QueuedFrame>, LANE_COUNT>     lanes_;
+    std::unordered_map<std::string_view, QueuedFrame *> conflated_;
+    LaneWeights                                         weights_;
+    LaneWeights                                         credits_;
+    std::deque<QueuedFrame>                             committed_;
+    std::size_t                                         head_offset_;
+    std::atomic<bool>                                   is_failed_;
+    bool                                                is_wake_signalled_;
+    std::size_t                                         zerocopy_threshold_;
+    std::uint32_t                                       zerocopy_next_;
+    std::deque<std::pair<std::uint32_t, Frame>>         zerocopy_pending_;
+    MemoryAccount                                       memory_;
+    std::size_t                                         memory_limit_;
+    std::size_t                                         queued_bytes_;
+    std::atomic<bool>                                   is_shed_;
+};
+
+} // namespace core
+
+#endif // NOHUB_CORE_CONNECTION_H
@@ -0,0 +1,184 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file datagram.cpp
+/// UDP multicast egress for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#include "datagram.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/uio.h>
+
+namespace core {
+
+namespace {
+
+/// \brief Receive buffer requested by multicast receivers, which have no
+/// flow control to slow down a burst (capped by net.core.rmem_max).
+constexpr int MULTICAST_RECV_BUFFER = 4 * 1024 * 1024;
+
+/// \brief Parse an IPv4 address.
+///
+/// \param ip Address in dotted notation.
+/// \return The address, in network byte order.
+/// \throws std::invalid_argument if the address is invalid.
+struct in_addr parse_ipv4(const std::string_view ip) {
+    struct in_addr addr{};
+    if (::inet_pton(AF_INET, std::string(ip).c_str(), &addr) <= 0) {
+        throw std::invalid_argument("invalid ip address: " + std::string(ip));
+    }
+
+    return addr;
+}
+
+/// \brief Create a UDP socket.
+///
+/// \return The socket.
+/// \throws std::runtime_error if socket creation fails.
+Socket create_udp_socket() {
+    int sock_fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        throw std::runtime_error(std::string("socket: ") +
+                                 std::strerror(errno));
+    }
+
+    return Socket(sock_fd);
+}
+
+void set_ip_option(int sock_fd, int option, const void *value, socklen_t len) {
+    if (::setsockopt(sock_fd, IPPROTO_IP, option, value, len) < 0) {
+        throw std::runtime_error(std::string("setsockopt: ") +
+                                 std::strerror(errno));
+    }
+}
+
+} // namespace
+
+MulticastSender::MulticastSender(const std::string_view group,
+                                 std::uint16_t          port,
+                                 const std::string_view interface_ip) {
+    struct sockaddr_in group_addr{};
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port   = htons(port);
+    group_addr.sin_addr   = parse_ipv4(group);
+    if (!IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr))) {
+        throw std::invalid_argument("not a multicast group: " +
+                                    std::string(group));
+    }
+
+    this->socket_ = create_udp_socket();
+    int sock_fd   = this->socket_.sock_fd();
+
+    // Stay on the local network, and deliver to receivers on this host too.
+    unsigned char ttl  = 1;
+    unsigned char loop = 1;
+    set_ip_option(sock_fd, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    set_ip_option(sock_fd, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (!interface_ip.empty()) {
+        struct in_addr interface_addr = parse_ipv4(interface_ip);
+        set_ip_option(sock_fd,
+                      IP_MULTICAST_IF,
+                      &interface_addr,
+                      sizeof(interface_addr));
+    }
+
+    // Connected, so that sending needs no address lookup per datagram.
+    this->socket_.connect_to(group_addr);
+}
+
+bool MulticastSender::send(std::uint64_t          sequence,
+                           const std::string_view message) noexcept {
+    char header[24];
+    auto [end, ec] =
+        std::to_chars(header, header + sizeof(header) - 1, sequence);
+    *end++ = ' ';
+
+    auto header_size = static_cast<std::size_t>(end - header);
+    if (header_size + message.size() > MAX_DATAGRAM_SIZE) {
+        return false;
+    }
+
+    struct iovec iov[2] = {
+        {header, header_size},
+        {const_cast<char *>(message.data()), message.size()},
+    };
+
+    struct msghdr msg{};
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+
+    ssize_t bytes_sent;
+    do {
+        bytes_sent = ::sendmsg(
+            this->socket_.sock_fd(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (bytes_sent < 0 && errno == EINTR);
+
+    return bytes_sent >= 0;
+}
+
+Socket multicast_join(const std::string_view group,
+                      std::uint16_t          port,
+                      const std::string_view interface_ip) {
+    struct ip_mreq membership{};
+    membership.imr_multiaddr = parse_ipv4(group);
+    if (!interface_ip.empty()) {
+        membership.imr_interface = parse_ipv4(interface_ip);
+    }
+
+    Socket socket      = create_udp_socket();
+    int    reuse       = 1;
+    int    recv_buffer = MULTICAST_RECV_BUFFER;
+    if (::setsockopt(socket.sock_fd(),
+                     SOL_SOCKET,
+                     SO_REUSEADDR,
+                     &reuse,
+                     sizeof(reuse)) < 0 ||
+        ::setsockopt(socket.sock_fd(),
+                     SOL_SOCKET,
+                     SO_RCVBUF,
+                     &recv_buffer,
+                     sizeof(recv_buffer)) < 0) {
+        throw std::runtime_error(std::string("setsockopt: ") +
+                                 std::strerror(errno));
+    }
+
+    struct sockaddr_in bind_addr{};
+    bind_addr.sin_family      = AF_INET;
+    bind_addr.sin_port        = htons(port);
+    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socket.bind_to(bind_addr);
+
+    set_ip_option(socket.sock_fd(),
+                  IP_ADD_MEMBERSHIP,
+                  &membership,
+                  sizeof(membership));
+    return socket;
+}
+
+bool parse_datagram(const std::string_view datagram,
+                    std::uint64_t         &sequence,
+                    std::string_view      &message) noexcept {
+    const char *begin = datagram.data();
+    const char *end   = datagram.data() + datagram.size();
+
+    auto [pos, ec] = std::from_chars(begin, end, sequence);
+    if (ec != std::errc() || pos == end || *pos != ' ') {
+        return false;
+    }
+
+    message = datagram.substr(static_cast<std::size_t>(pos + 1 - begin));
+    return true;
+}
+
+} // namespace core
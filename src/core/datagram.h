@@ -0,0 +1,89 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file datagram.h
+/// UDP multicast egress for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_DATAGRAM_H
+#define NOHUB_CORE_DATAGRAM_H
+
+#include "socket.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace core {
+
+/// \brief Largest payload of a UDP datagram over IPv4.
+constexpr std::size_t MAX_DATAGRAM_SIZE = 65507;
+
+/// \brief Sends messages once to a multicast group, whatever the number of
+/// receivers.
+///
+/// Each datagram holds one message preceded by its sequence number in
+/// decimal and a space, so that receivers can detect losses.
+class MulticastSender {
+  public:
+    /// \brief Constructor for MulticastSender class.
+    ///
+    /// \param group IPv4 multicast group address.
+    /// \param port Destination port.
+    /// \param interface_ip Address of the outgoing interface (empty for the
+    /// default route).
+    /// \throws std::invalid_argument if an address is invalid.
+    /// \throws std::runtime_error if the socket cannot be set up.
+    explicit MulticastSender(const std::string_view group,
+                             std::uint16_t          port,
+                             const std::string_view interface_ip);
+    MulticastSender() = delete;
+
+    /// \brief Send a message to the group.
+    ///
+    /// Never blocks: receivers tolerate loss, so a datagram the kernel
+    /// cannot take right away is dropped.
+    ///
+    /// \param sequence Sequence number of the message.
+    /// \param message The message.
+    /// \return True if the datagram was sent.
+    bool send(std::uint64_t sequence, const std::string_view message) noexcept;
+
+  private:
+    Socket socket_;
+};
+
+/// \brief Join a multicast group.
+///
+/// The socket is bound with SO_REUSEADDR, so that several receivers on the
+/// same host can share the port.
+///
+/// \param group IPv4 multicast group address.
+/// \param port Port the group is sent to.
+/// \param interface_ip Address of the interface to join on (empty to let the
+/// kernel choose).
+/// \return Socket receiving the group's datagrams.
+/// \throws std::invalid_argument if an address is invalid.
+/// \throws std::runtime_error if the socket cannot be set up.
+Socket multicast_join(const std::string_view group,
+                      std::uint16_t          port,
+                      const std::string_view interface_ip);
+
+/// \brief Split a datagram into its sequence number and message.
+///
+/// \param datagram The datagram.
+/// \param sequence Receives the sequence number.
+/// \param message Receives the message, as a view into the datagram.
+/// \return True if the datagram is well formed.
+bool parse_datagram(const std::string_view datagram,
+                    std::uint64_t         &sequence,
+                    std::string_view      &message) noexcept;
+
+} // namespace core
+
+#endif // NOHUB_CORE_DATAGRAM_H
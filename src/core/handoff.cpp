@@ -0,0 +1,300 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file handoff.cpp
+/// Hot restart handoff of listening and client sockets for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#include "handoff.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace core {
+
+namespace {
+
+/// \brief Kind of a record exchanged during a handoff.
+enum class HandoffRecord : std::uint32_t {
+    LISTENER   = 1, ///< Carries the listening socket.
+    CONNECTION = 2, ///< Carries a client socket and its first data chunk.
+    DATA       = 3, ///< Continues the buffered data of the last client.
+    END        = 4, ///< Marks the end of the handoff.
+    OUTPUT     = 5, ///< Continues the outbound data of the last client.
+    CHANNEL    = 6, ///< Names a channel the last client is subscribed to.
+    SEQUENCE   = 7, ///< Last sequence number of a channel, then its name.
+};
+
+/// \brief Header preceding the payload of every record.
+struct HandoffHeader {
+    HandoffRecord kind;
+    std::uint32_t length;
+};
+
+/// \brief Largest payload carried by a single record.
+constexpr std::size_t HANDOFF_CHUNK_SIZE = 16 * 1024;
+
+sockaddr_un make_unix_addr(const std::string_view path) {
+    struct sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("handoff: invalid socket path");
+    }
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return addr;
+}
+
+void send_record(int                    peer_fd,
+                 HandoffRecord          kind,
+                 const std::string_view payload,
+                 int                    attached_fd = -1) {
+    HandoffHeader header{kind, static_cast<std::uint32_t>(payload.size())};
+    struct iovec  iov[2] = {
+        {&header, sizeof(header)},
+        {const_cast<char *>(payload.data()), payload.size()},
+    };
+
+    struct msghdr msg{};
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = payload.empty() ? 1 : 2;
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    if (attached_fd >= 0) {
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level     = SOL_SOCKET;
+        cmsg->cmsg_type      = SCM_RIGHTS;
+        cmsg->cmsg_len       = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &attached_fd, sizeof(int));
+    }
+
+    while (::sendmsg(peer_fd, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) {
+            throw std::runtime_error(std::string("handoff: sendmsg: ") +
+                                     std::strerror(errno));
+        }
+    }
+}
+
+HandoffRecord
+recv_record(int peer_fd, std::string &payload, int &attached_fd) {
+    HandoffHeader header{};
+    payload.resize(HANDOFF_CHUNK_SIZE);
+    struct iovec iov[2] = {
+        {&header, sizeof(header)},
+        {payload.data(), payload.size()},
+    };
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr                msg{};
+    msg.msg_iov        = iov;
+    msg.msg_iovlen     = 2;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t bytes_received;
+    do {
+        bytes_received = ::recvmsg(peer_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (bytes_received < 0 && errno == EINTR);
+
+    if (bytes_received < 0) {
+        throw std::runtime_error(std::string("handoff: recvmsg: ") +
+                                 std::strerror(errno));
+    }
+
+    attached_fd = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg                 = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(&attached_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (static_cast<std::size_t>(bytes_received) < sizeof(header) ||
+        header.length != static_cast<std::size_t>(bytes_received) -
+                             sizeof(header) ||
+        (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+        if (attached_fd >= 0) {
+            ::close(attached_fd);
+        }
+
+        throw std::runtime_error("handoff: malformed record");
+    }
+
+    payload.resize(header.length);
+    return header.kind;
+}
+
+} // namespace
+
+int handoff_listen(const std::string_view path) {
+    struct sockaddr_un addr = make_unix_addr(path);
+
+    int listen_fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error(std::string("handoff: socket: ") +
+                                 std::strerror(errno));
+    }
+
+    ::unlink(addr.sun_path);
+    if (::bind(listen_fd,
+               reinterpret_cast<const struct sockaddr *>(&addr),
+               sizeof(addr)) < 0 ||
+        ::listen(listen_fd, 1) < 0) {
+        int saved_errno = errno;
+        ::close(listen_fd);
+        throw std::runtime_error(std::string("handoff: bind/listen: ") +
+                                 std::strerror(saved_errno));
+    }
+
+    return listen_fd;
+}
+
+int handoff_accept(int listen_fd) {
+    int peer_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (peer_fd < 0) {
+        throw std::runtime_error(std::string("handoff: accept: ") +
+                                 std::strerror(errno));
+    }
+
+    struct ucred cred{};
+    socklen_t    cred_len = sizeof(cred);
+    if (::getsockopt(peer_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 ||
+        cred.uid != ::geteuid()) {
+        ::close(peer_fd);
+        throw std::runtime_error("handoff: rejected request from another user");
+    }
+
+    return peer_fd;
+}
+
+void handoff_send(int peer_fd, const HandoffState &state) {
+    send_record(peer_fd, HandoffRecord::LISTENER, {}, state.listen_fd);
+
+    for (const HandoffConnection &connection : state.connections) {
+        std::string_view buffered(connection.buffered);
+        std::string_view chunk = buffered.substr(0, HANDOFF_CHUNK_SIZE);
+        send_record(
+            peer_fd, HandoffRecord::CONNECTION, chunk, connection.sock_fd);
+
+        for (buffered.remove_prefix(chunk.size()); !buffered.empty();
+             buffered.remove_prefix(chunk.size())) {
+            chunk = buffered.substr(0, HANDOFF_CHUNK_SIZE);
+            send_record(peer_fd, HandoffRecord::DATA, chunk);
+        }
+
+        for (std::string_view outbound(connection.outbound); !outbound.empty();
+             outbound.remove_prefix(chunk.size())) {
+            chunk = outbound.substr(0, HANDOFF_CHUNK_SIZE);
+            send_record(peer_fd, HandoffRecord::OUTPUT, chunk);
+        }
+
+        // A name too long for one record cannot be a real subscription.
+        for (const std::string &channel : connection.channels) {
+            if (channel.size() <= HANDOFF_CHUNK_SIZE) {
+                send_record(peer_fd, HandoffRecord::CHANNEL, channel);
+            }
+        }
+    }
+
+    for (const auto &[channel, sequence] : state.sequences) {
+        if (channel.size() + sizeof(sequence) <= HANDOFF_CHUNK_SIZE) {
+            std::string payload(sizeof(sequence), '\0');
+            std::memcpy(payload.data(), &sequence, sizeof(sequence));
+            send_record(peer_fd, HandoffRecord::SEQUENCE, payload + channel);
+        }
+    }
+
+    send_record(peer_fd, HandoffRecord::END, {});
+}
+
+HandoffState handoff_receive(const std::string_view path) {
+    struct sockaddr_un addr = make_unix_addr(path);
+
+    int peer_fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (peer_fd < 0) {
+        throw std::runtime_error(std::string("handoff: socket: ") +
+                                 std::strerror(errno));
+    }
+
+    HandoffState state;
+    try {
+        if (::connect(peer_fd,
+                      reinterpret_cast<const struct sockaddr *>(&addr),
+                      sizeof(addr)) < 0) {
+            throw std::runtime_error(std::string("handoff: connect: ") +
+                                     std::strerror(errno));
+        }
+
+        std::string payload;
+        int         attached_fd;
+        while (true) {
+            HandoffRecord kind = recv_record(peer_fd, payload, attached_fd);
+            if (kind == HandoffRecord::END) {
+                break;
+            }
+
+            if (kind == HandoffRecord::LISTENER && attached_fd >= 0 &&
+                state.listen_fd < 0) {
+                state.listen_fd = attached_fd;
+            } else if (kind == HandoffRecord::CONNECTION && attached_fd >= 0) {
+                state.connections.push_back({attached_fd, payload, {}, {}});
+            } else if (kind == HandoffRecord::DATA && attached_fd < 0 &&
+                       !state.connections.empty()) {
+                state.connections.back().buffered += payload;
+            } else if (kind == HandoffRecord::OUTPUT && attached_fd < 0 &&
+                       !state.connections.empty()) {
+                state.connections.back().outbound += payload;
+            } else if (kind == HandoffRecord::CHANNEL && attached_fd < 0 &&
+                       !state.connections.empty()) {
+                state.connections.back().channels.push_back(payload);
+            } else if (kind == HandoffRecord::SEQUENCE && attached_fd < 0 &&
+                       payload.size() > sizeof(std::uint64_t)) {
+                std::uint64_t sequence;
+                std::memcpy(&sequence, payload.data(), sizeof(sequence));
+                state.sequences.emplace_back(payload.substr(sizeof(sequence)),
+                                             sequence);
+            } else {
+                if (attached_fd >= 0) {
+                    ::close(attached_fd);
+                }
+
+                throw std::runtime_error("handoff: unexpected record");
+            }
+        }
+
+        if (state.listen_fd < 0) {
+            throw std::runtime_error("handoff: no listening socket received");
+        }
+    } catch (...) {
+        ::close(peer_fd);
+        if (state.listen_fd >= 0) {
+            ::close(state.listen_fd);
+        }
+
+        for (const HandoffConnection &connection : state.connections) {
+            ::close(connection.sock_fd);
+        }
+
+        throw;
+    }
+
+    ::close(peer_fd);
+    return state;
+}
+
+} // namespace core
@@ -0,0 +1,89 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file handoff.h
+/// Hot restart handoff of listening and client sockets for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_HANDOFF_H
+#define NOHUB_CORE_HANDOFF_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace core {
+
+/// \brief A live client connection passed between server processes.
+struct HandoffConnection {
+    /// Socket file descriptor of the client.
+    int sock_fd = -1;
+
+    /// Bytes received from the client that do not form a full line yet.
+    std::string buffered = std::string();
+
+    /// Bytes queued for the client that were not sent yet.
+    std::string outbound = std::string();
+
+    /// Channels the client is subscribed to.
+    std::vector<std::string> channels = {};
+};
+
+/// \brief Everything a server process hands to its successor.
+struct HandoffState {
+    /// File descriptor of the listening socket.
+    int listen_fd = -1;
+
+    /// Connected clients, in no particular order.
+    std::vector<HandoffConnection> connections = {};
+
+    /// Last sequence number of each numbered channel, so that subscribers
+    /// see the numbering continue.
+    std::vector<std::pair<std::string, std::uint64_t>> sequences = {};
+};
+
+/// \brief Create a Unix socket accepting handoff requests.
+///
+/// Any stale socket file at the given path is removed first.
+///
+/// \param path Filesystem path of the Unix socket.
+/// \return File descriptor of the listening Unix socket.
+/// \throws std::runtime_error if the socket cannot be created.
+int handoff_listen(const std::string_view path);
+
+/// \brief Accept a handoff request from a successor process.
+///
+/// Requests from processes running as another user are rejected.
+///
+/// \param listen_fd File descriptor returned by handoff_listen().
+/// \return File descriptor connected to the successor.
+/// \throws std::runtime_error if accept fails or the peer is not trusted.
+int handoff_accept(int listen_fd);
+
+/// \brief Send the listening socket and client connections to a successor.
+///
+/// File descriptors are duplicated into the receiving process; the caller
+/// still owns and must close its own copies.
+///
+/// \param peer_fd File descriptor returned by handoff_accept().
+/// \param state Sockets and buffered data to transfer.
+/// \throws std::runtime_error if sending fails.
+void handoff_send(int peer_fd, const HandoffState &state);
+
+/// \brief Take over the sockets of the server listening at a handoff path.
+///
+/// \param path Filesystem path of the running server's handoff socket.
+/// \return The received sockets, owned by the caller.
+/// \throws std::runtime_error if connecting or receiving fails.
+HandoffState handoff_receive(const std::string_view path);
+
+} // namespace core
+
+#endif // NOHUB_CORE_HANDOFF_H
@@ -0,0 +1,125 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file live_value.h
+/// Value replaced at runtime while other threads keep reading it.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_LIVE_VALUE_H
+#define NOHUB_CORE_LIVE_VALUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace core {
+
+/// \brief Immutable value that writers replace as a whole.
+///
+/// A writer publishes a new copy with store(); readers keep using the copy
+/// they hold until they ask for the latest one. Each copy is freed once its
+/// last reader has moved on.
+///
+/// std::atomic<std::shared_ptr> is not lock-free in libstdc++: load() and
+/// store() take an internal spin lock. Readers only reach it through
+/// Reader::refresh() after the version changed, so the lock is taken once
+/// per reader per store() rather than on every read.
+///
+/// \tparam T Value type.
+template <typename T> class LiveValue {
+  public:
+    /// \brief Per-thread view of a LiveValue.
+    ///
+    /// Checking for a new value costs a single load of the version number;
+    /// the shared pointer, whose reference count every reader would contend
+    /// on, is only touched when the value has changed.
+    class Reader {
+      public:
+        /// \brief Constructor for Reader class.
+        ///
+        /// \param live The value to read.
+        explicit Reader(const LiveValue &live)
+            : live_(live), version_(live.version()), value_(live.load()) {}
+        Reader() = delete;
+
+        /// \brief Pick up the latest value if it changed.
+        ///
+        /// The reference stays valid until the next call to refresh().
+        ///
+        /// \return The latest value.
+        const T &refresh() {
+            std::uint64_t version = this->live_.version();
+            if (version != this->version_) {
+                this->version_ = version;
+                this->value_   = this->live_.load();
+            }
+
+            return *this->value_;
+        }
+
+        /// \brief Get the value picked up by the last refresh.
+        ///
+        /// \return The value.
+        const T &operator*() const noexcept { return *this->value_; }
+
+        /// \brief Access a member of the value picked up by the last refresh.
+        ///
+        /// \return Pointer to the value.
+        const T *operator->() const noexcept { return this->value_.get(); }
+
+      private:
+        const LiveValue         &live_;
+        std::uint64_t            version_;
+        std::shared_ptr<const T> value_;
+    };
+
+    /// \brief Constructor for LiveValue class.
+    ///
+    /// \param value Initial value.
+    explicit LiveValue(T value)
+        : value_(std::make_shared<const T>(std::move(value))), version_(0) {}
+    LiveValue() = delete;
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    LiveValue(const LiveValue &)            = delete;
+    LiveValue &operator=(const LiveValue &) = delete;
+
+    /// \brief Get the latest value.
+    ///
+    /// Not lock-free; prefer a Reader on hot paths.
+    ///
+    /// \return Shared pointer to the value.
+    std::shared_ptr<const T> load() const {
+        return this->value_.load(std::memory_order_acquire);
+    }
+
+    /// \brief Replace the value; readers pick it up at their next refresh.
+    ///
+    /// \param value New value.
+    void store(T value) {
+        this->value_.store(std::make_shared<const T>(std::move(value)),
+                           std::memory_order_release);
+        this->version_.fetch_add(1, std::memory_order_release);
+    }
+
+    /// \brief Get the number of times the value was replaced.
+    ///
+    /// \return Version number.
+    std::uint64_t version() const noexcept {
+        return this->version_.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::atomic<std::shared_ptr<const T>> value_;
+    std::atomic<std::uint64_t>            version_;
+};
+
+} // namespace core
+
+#endif // NOHUB_CORE_LIVE_VALUE_H
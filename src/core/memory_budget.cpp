@@ -0,0 +1,124 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file memory_budget.cpp
+/// Accounting of the memory the server holds on behalf of clients.
+///
+//===----------------------------------------------------------------------===//
+
+#include "memory_budget.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace core {
+
+MemoryBudget::MemoryBudget(std::size_t limit)
+    : used_(0), limit_(limit), is_signalled_(false), event_fd_(-1) {
+    this->event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (this->event_fd_ < 0) {
+        throw std::runtime_error(std::string("memory budget: eventfd: ") +
+                                 std::strerror(errno));
+    }
+}
+
+MemoryBudget::~MemoryBudget() { ::close(this->event_fd_); }
+
+void MemoryBudget::set_limit(std::size_t limit) noexcept {
+    this->limit_.store(limit, std::memory_order_relaxed);
+    if (exceeded()) {
+        signal();
+    }
+}
+
+void MemoryBudget::charge(std::size_t bytes) noexcept {
+    this->used_.fetch_add(bytes, std::memory_order_relaxed);
+    if (exceeded()) {
+        signal();
+    }
+}
+
+void MemoryBudget::release(std::size_t bytes) noexcept {
+    this->used_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryBudget::clear_event() noexcept {
+    eventfd_t value;
+    ::eventfd_read(this->event_fd_, &value);
+    this->is_signalled_.store(false, std::memory_order_relaxed);
+}
+
+void MemoryBudget::signal() noexcept {
+    // A server staying over the limit is woken once per handled signal,
+    // not for every frame charged meanwhile.
+    if (!this->is_signalled_.exchange(true, std::memory_order_relaxed)) {
+        ::eventfd_write(this->event_fd_, 1);
+    }
+}
+
+MemoryAccount::MemoryAccount(std::shared_ptr<MemoryBudget> budget) noexcept
+    : budget_(std::move(budget)), used_(), total_(0), reported_(0) {}
+
+MemoryAccount::~MemoryAccount() {
+    if (this->budget_ != nullptr) {
+        this->budget_->release(this->reported_.load());
+    }
+}
+
+void MemoryAccount::charge(MemoryKind kind, std::size_t bytes) noexcept {
+    this->used_[static_cast<std::size_t>(kind)].fetch_add(
+        bytes, std::memory_order_relaxed);
+    report(this->total_.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void MemoryAccount::release(MemoryKind kind, std::size_t bytes) noexcept {
+    this->used_[static_cast<std::size_t>(kind)].fetch_sub(
+        bytes, std::memory_order_relaxed);
+    report(this->total_.fetch_sub(bytes, std::memory_order_relaxed) - bytes);
+}
+
+void MemoryAccount::set(MemoryKind kind, std::size_t bytes) noexcept {
+    std::size_t before = this->used_[static_cast<std::size_t>(kind)].exchange(
+        bytes, std::memory_order_relaxed);
+    if (bytes > before) {
+        report(this->total_.fetch_add(bytes - before,
+                                      std::memory_order_relaxed) +
+               (bytes - before));
+    } else if (bytes < before) {
+        report(this->total_.fetch_sub(before - bytes,
+                                      std::memory_order_relaxed) -
+               (before - bytes));
+    }
+}
+
+void MemoryAccount::report(std::size_t total) noexcept {
+    if (this->budget_ == nullptr) {
+        return;
+    }
+
+    // Whichever thread moves reported_ applies exactly that move to the
+    // budget, so the budget always holds the sum of what accounts reported.
+    std::size_t reported = this->reported_.load(std::memory_order_relaxed);
+    if (total <= reported + GRANULE && total + GRANULE >= reported) {
+        return;
+    }
+
+    if (this->reported_.compare_exchange_strong(
+            reported, total, std::memory_order_relaxed)) {
+        if (total > reported) {
+            this->budget_->charge(total - reported);
+        } else {
+            this->budget_->release(reported - total);
+        }
+    }
+}
+
+} // namespace core
@@ -0,0 +1,251 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file memory_budget.h
+/// Accounting of the memory the server holds on behalf of clients.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_MEMORY_BUDGET_H
+#define NOHUB_CORE_MEMORY_BUDGET_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace core {
+
+/// \brief What buffered bytes are held for.
+enum class MemoryKind : std::uint8_t {
+    READ     = 0, ///< Received data not handled yet.
+    OUTBOUND = 1, ///< Frames queued for sending.
+    HISTORY  = 2, ///< Last values and unacknowledged messages of channels.
+};
+
+/// \brief Number of memory kinds.
+constexpr std::size_t MEMORY_KIND_COUNT = 3;
+
+/// \brief What the server does while its memory budget is exceeded.
+enum class ShedPolicy : std::uint8_t {
+    EVICT = 0, ///< Disconnect the clients holding the most memory.
+    PAUSE = 1, ///< Hold back lines that add memory until usage drops.
+};
+
+/// \brief Server-wide count of buffered bytes, checked against a limit.
+///
+/// Accounts report to the budget in steps of MemoryAccount::GRANULE bytes
+/// rather than for every frame, so that threads queueing frames for
+/// different clients do not all contend on one counter. The total is thus
+/// accurate to within a granule per account.
+class MemoryBudget {
+  public:
+    /// \brief Constructor for MemoryBudget class.
+    ///
+    /// \param limit Bytes above which the budget is exceeded (0 for no
+    /// limit).
+    /// \throws std::runtime_error if the event descriptor cannot be created.
+    explicit MemoryBudget(std::size_t limit);
+    MemoryBudget() = delete;
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    MemoryBudget(const MemoryBudget &)            = delete;
+    MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+    /// \brief Destructor for MemoryBudget class.
+    ~MemoryBudget();
+
+    /// \brief Change the limit.
+    ///
+    /// \param limit Bytes above which the budget is exceeded (0 for no
+    /// limit).
+    void set_limit(std::size_t limit) noexcept;
+
+    /// \brief Get the limit.
+    ///
+    /// \return Limit in bytes, or 0 if there is none.
+    std::size_t limit() const noexcept {
+        return this->limit_.load(std::memory_order_relaxed);
+    }
+
+    /// \brief Get the number of bytes charged.
+    ///
+    /// \return Bytes in use.
+    std::size_t used() const noexcept {
+        return this->used_.load(std::memory_order_relaxed);
+    }
+
+    /// \brief Check whether usage is over the limit.
+    ///
+    /// \return True if the budget is exceeded.
+    bool exceeded() const noexcept {
+        std::size_t limit = this->limit();
+        return limit > 0 && used() > limit;
+    }
+
+    /// \brief Add bytes to the usage.
+    ///
+    /// \param bytes Number of bytes.
+    void charge(std::size_t bytes) noexcept;
+
+    /// \brief Remove bytes from the usage.
+    ///
+    /// \param bytes Number of bytes.
+    void release(std::size_t bytes) noexcept;
+
+    /// \brief Get the descriptor that becomes readable when bytes are
+    /// charged while usage is over the limit.
+    ///
+    /// \return Eventfd file descriptor.
+    int event_fd() const noexcept { return this->event_fd_; }
+
+    /// \brief Consume a pending over-limit signal.
+    void clear_event() noexcept;
+
+  private:
+    /// Signal event_fd_ unless a signal is already pending.
+    void signal() noexcept;
+
+    std::atomic<std::size_t> used_;
+    std::atomic<std::size_t> limit_;
+    std::atomic<bool>        is_signalled_;
+    int                      event_fd_;
+};
+
+/// \brief Bytes held on behalf of one client, or of the channels, by kind.
+///
+/// Charges come from any thread; the account's total is reported to its
+/// budget whenever it has moved by more than GRANULE bytes since the last
+/// report. Whatever is still charged is released when the account is
+/// destroyed.
+class MemoryAccount {
+  public:
+    /// \brief Change in usage after which an account reports to its budget.
+    static constexpr std::size_t GRANULE = 4 * 1024;
+
+    /// \brief Constructor for MemoryAccount class.
+    ///
+    /// \param budget Budget the usage counts against (nullptr for none).
+    explicit MemoryAccount(std::shared_ptr<MemoryBudget> budget) noexcept;
+    MemoryAccount() = delete;
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    MemoryAccount(const MemoryAccount &)            = delete;
+    MemoryAccount &operator=(const MemoryAccount &) = delete;
+
+    /// \brief Destructor for MemoryAccount class.
+    ~MemoryAccount();
+
+    /// \brief Add bytes to the usage.
+    ///
+    /// \param kind What the bytes are held for.
+    /// \param bytes Number of bytes.
+    void charge(MemoryKind kind, std::size_t bytes) noexcept;
+
+    /// \brief Remove bytes from the usage.
+    ///
+    /// \param kind What the bytes were held for.
+    /// \param bytes Number of bytes.
+    void release(MemoryKind kind, std::size_t bytes) noexcept;
+
+    /// \brief Set the usage of one kind, e.g. the size of a buffer.
+    ///
+    /// \param kind What the bytes are held for.
+    /// \param bytes Number of bytes.
+    void set(MemoryKind kind, std::size_t bytes) noexcept;
+
+    /// \brief Get the total usage.
+    ///
+    /// \return Bytes in use.
+    std::size_t used() const noexcept {
+        return this->total_.load(std::memory_order_relaxed);
+    }
+
+    /// \brief Get the usage of one kind.
+    ///
+    /// \param kind What the bytes are held for.
+    /// \return Bytes in use.
+    std::size_t used(MemoryKind kind) const noexcept {
+        return this->used_[static_cast<std::size_t>(kind)].load(
+            std::memory_order_relaxed);
+    }
+
+  private:
+    /// Report the total to the budget if it moved by more than a granule.
+    void report(std::size_t total) noexcept;
+
+    std::shared_ptr<MemoryBudget>                           budget_;
+    std::array<std::atomic<std::size_t>, MEMORY_KIND_COUNT> used_;
+    std::atomic<std::size_t>                                total_;
+    std::atomic<std::size_t>                                reported_;
+};
+
+/// \brief Bytes charged to an account for as long as the charge lives.
+///
+/// Stored next to what it accounts for, so that the bytes are released
+/// however the owning container drops it. The account must outlive it.
+class MemoryCharge {
+  public:
+    /// \brief Constructor for an empty charge.
+    MemoryCharge() noexcept : account_(nullptr), kind_(), bytes_(0) {}
+
+    /// \brief Constructor for MemoryCharge class.
+    ///
+    /// \param account Account to charge.
+    /// \param kind What the bytes are held for.
+    /// \param bytes Number of bytes.
+    MemoryCharge(MemoryAccount &account,
+                 MemoryKind     kind,
+                 std::size_t    bytes) noexcept
+        : account_(&account), kind_(kind), bytes_(bytes) {
+        account.charge(kind, bytes);
+    }
+
+    /// \brief Move constructor; the moved-from charge becomes empty.
+    MemoryCharge(MemoryCharge &&other) noexcept
+        : account_(other.account_), kind_(other.kind_), bytes_(other.bytes_) {
+        other.account_ = nullptr;
+    }
+
+    /// \brief Move assignment; releases the charge being replaced.
+    MemoryCharge &operator=(MemoryCharge &&other) noexcept {
+        if (this != &other) {
+            reset();
+            this->account_ = other.account_;
+            this->kind_    = other.kind_;
+            this->bytes_   = other.bytes_;
+            other.account_ = nullptr;
+        }
+
+        return *this;
+    }
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    MemoryCharge(const MemoryCharge &)            = delete;
+    MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+    /// \brief Destructor for MemoryCharge class.
+    ~MemoryCharge() { reset(); }
+
+  private:
+    /// Release the bytes and become empty.
+    void reset() noexcept {
+        if (this->account_ != nullptr) {
+            this->account_->release(this->kind_, this->bytes_);
+            this->account_ = nullptr;
+        }
+    }
+
+    MemoryAccount *account_;
+    MemoryKind     kind_;
+    std::size_t    bytes_;
+};
+
+} // namespace core
+
+#endif // NOHUB_CORE_MEMORY_BUDGET_H
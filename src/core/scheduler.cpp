@@ -0,0 +1,222 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file scheduler.cpp
+/// Work-stealing task scheduler for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+
+namespace core {
+
+namespace {
+
+/// \brief Failed task searches before an idle worker goes to sleep.
+constexpr std::size_t IDLE_SPIN_ROUNDS = 64;
+
+/// \brief Scheduler owning the calling thread, if it is a worker.
+thread_local Scheduler *current_scheduler = nullptr;
+
+/// \brief Index of the calling thread within its scheduler.
+thread_local std::size_t current_worker = 0;
+
+} // namespace
+
+Scheduler::Scheduler(std::size_t workers, std::function<void()> on_worker_start)
+    : on_worker_start_(std::move(on_worker_start)), inject_size_(0),
+      signal_(0), is_stopping_(false) {
+    // All deques exist before any thread may try to steal from them.
+    for (std::size_t i = 0; i < workers; ++i) {
+        this->workers_.push_back(std::make_unique<Worker>());
+    }
+
+    for (std::size_t i = 0; i < workers; ++i) {
+        this->workers_[i]->thread =
+            std::thread(&Scheduler::worker_loop, this, i);
+    }
+}
+
+Scheduler::~Scheduler() {
+    this->is_stopping_.store(true, std::memory_order_release);
+    notify(true);
+
+    for (auto &worker : this->workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    for (auto &worker : this->workers_) {
+        while (auto task = worker->deque.pop()) {
+            delete *task;
+        }
+    }
+
+    for (Task *task : this->inject_queue_) {
+        delete task;
+    }
+}
+
+std::size_t Scheduler::workers() const noexcept {
+    return this->workers_.size();
+}
+
+void Scheduler::submit(Task task) {
+    auto *queued = new Task(std::move(task));
+
+    if (current_scheduler == this) {
+        this->workers_[current_worker]->deque.push(queued);
+    } else {
+        std::lock_guard<std::mutex> lock(this->inject_mutex_);
+        this->inject_queue_.push_back(queued);
+        this->inject_size_.fetch_add(1, std::memory_order_release);
+    }
+
+    notify(false);
+}
+
+void Scheduler::parallel_for(std::size_t      count,
+                             std::size_t      grain,
+                             const RangeBody &body) {
+    grain = std::max<std::size_t>(grain, 1);
+
+    // A worker waiting for its own loop could starve the pool, so nested
+    // loops run inline.
+    if (count <= grain || this->workers_.empty() ||
+        current_scheduler == this) {
+        if (count > 0) {
+            body(0, count);
+        }
+
+        return;
+    }
+
+    auto state   = std::make_shared<LoopState>();
+    state->body  = &body;
+    state->grain = grain;
+    state->remaining.store(count, std::memory_order_relaxed);
+
+    // The caller splits the range itself and then helps with the pieces,
+    // rather than sitting idle while the workers pick them up.
+    run_range(state, 0, count);
+
+    std::size_t left = state->remaining.load(std::memory_order_acquire);
+    while (left != 0) {
+        if (Task *task = steal_task(0, this->workers_.size())) {
+            run_task(task);
+        } else {
+            state->remaining.wait(left, std::memory_order_acquire);
+        }
+
+        left = state->remaining.load(std::memory_order_acquire);
+    }
+}
+
+void Scheduler::worker_loop(std::size_t index) {
+    current_scheduler = this;
+    current_worker    = index;
+
+    if (this->on_worker_start_) {
+        this->on_worker_start_();
+    }
+
+    std::size_t idle_rounds = 0;
+    while (!this->is_stopping_.load(std::memory_order_acquire)) {
+        // Read the signal before searching, so a task submitted after a
+        // failed search always wakes this worker up again.
+        std::uint32_t observed = this->signal_.load(std::memory_order_acquire);
+
+        Task *task = find_task(index);
+        if (task != nullptr) {
+            run_task(task);
+            idle_rounds = 0;
+            continue;
+        }
+
+        if (++idle_rounds < IDLE_SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        this->signal_.wait(observed, std::memory_order_acquire);
+        idle_rounds = 0;
+    }
+}
+
+Scheduler::Task *Scheduler::find_task(std::size_t index) {
+    if (auto task = this->workers_[index]->deque.pop()) {
+        return *task;
+    }
+
+    return steal_task(index + 1, this->workers_.size() - 1);
+}
+
+Scheduler::Task *Scheduler::steal_task(std::size_t first, std::size_t count) {
+    if (this->inject_size_.load(std::memory_order_acquire) > 0) {
+        std::lock_guard<std::mutex> lock(this->inject_mutex_);
+        if (!this->inject_queue_.empty()) {
+            Task *task = this->inject_queue_.front();
+            this->inject_queue_.pop_front();
+            this->inject_size_.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+
+    std::size_t workers = this->workers_.size();
+    for (std::size_t i = 0; i < count; ++i) {
+        if (auto task = this->workers_[(first + i) % workers]->deque.steal()) {
+            return *task;
+        }
+    }
+
+    return nullptr;
+}
+
+void Scheduler::run_task(Task *task) noexcept {
+    try {
+        (*task)();
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "[-] scheduler: task failed: %s\n", e.what());
+    }
+
+    delete task;
+}
+
+void Scheduler::run_range(const std::shared_ptr<LoopState> &state,
+                          std::size_t                       begin,
+                          std::size_t                       end) {
+    // Keep the first half and offer the second one to thieves, until the
+    // piece left is small enough to run.
+    while (end - begin > state->grain) {
+        std::size_t middle = begin + (end - begin) / 2;
+        submit([this, state, middle, end]() { run_range(state, middle, end); });
+        end = middle;
+    }
+
+    (*state->body)(begin, end);
+
+    std::size_t done = end - begin;
+    if (state->remaining.fetch_sub(done, std::memory_order_acq_rel) == done) {
+        state->remaining.notify_all();
+    }
+}
+
+void Scheduler::notify(bool all) noexcept {
+    this->signal_.fetch_add(1, std::memory_order_release);
+    if (all) {
+        this->signal_.notify_all();
+    } else {
+        this->signal_.notify_one();
+    }
+}
+
+} // namespace core
@@ -0,0 +1,149 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file scheduler.h
+/// Work-stealing task scheduler for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_SCHEDULER_H
+#define NOHUB_CORE_SCHEDULER_H
+
+#include "work_deque.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+class Scheduler {
+  public:
+    /// \brief Task executed by the scheduler.
+    using Task = std::function<void()>;
+
+    /// \brief Body of a parallel loop, called with a [begin, end) range.
+    using RangeBody = std::function<void(std::size_t, std::size_t)>;
+
+    /// \brief Constructor for Scheduler class.
+    ///
+    /// \param workers Number of worker threads.
+    /// \param on_worker_start Function run by each worker thread before it
+    /// executes any task, e.g. to set its CPU affinity.
+    explicit Scheduler(std::size_t           workers,
+                       std::function<void()> on_worker_start = nullptr);
+    Scheduler() = delete;
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    Scheduler(const Scheduler &)            = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    /// \brief Destructor for Scheduler class.
+    ///
+    /// Stops the workers; tasks that have not started are discarded.
+    ~Scheduler();
+
+    /// \brief Get the number of worker threads.
+    ///
+    /// \return The number of worker threads.
+    std::size_t workers() const noexcept;
+
+    /// \brief Submit a task for asynchronous execution.
+    ///
+    /// From a worker thread the task goes to that worker's own deque, where
+    /// idle workers can steal it; otherwise it is queued for any worker.
+    ///
+    /// \param task Task to execute.
+    void submit(Task task);
+
+    /// \brief Run a loop body over [0, count) on the workers and wait.
+    ///
+    /// The range is split in halves recursively, and the halves are made
+    /// available for stealing, until pieces are at most `grain` long. The
+    /// calling thread runs pieces too until none is left, and only then
+    /// waits for the workers. Runs inline if the range is small or when
+    /// called from a worker thread.
+    ///
+    /// \param count Number of iterations.
+    /// \param grain Largest number of iterations run as a single piece.
+    /// \param body Loop body, called concurrently for disjoint ranges. It must
+    /// not throw.
+    void parallel_for(std::size_t      count,
+                      std::size_t      grain,
+                      const RangeBody &body);
+
+  private:
+    /// \brief State shared by the pieces of a parallel loop.
+    struct LoopState {
+        const RangeBody         *body;
+        std::size_t              grain;
+        std::atomic<std::size_t> remaining;
+    };
+
+    /// \brief Per-worker state.
+    struct Worker {
+        WorkDeque<Task *> deque;
+        std::thread       thread;
+    };
+
+    /// Worker thread main loop.
+    ///
+    /// \param index Index of the worker.
+    void worker_loop(std::size_t index);
+
+    /// Find a task for a worker: its own deque first, then the injection
+    /// queue, then the other workers' deques.
+    ///
+    /// \param index Index of the worker.
+    /// \return Task to run, or nullptr if none was found.
+    Task *find_task(std::size_t index);
+
+    /// Take a task from the injection queue, or else steal one from the
+    /// workers' deques. Safe from any thread.
+    ///
+    /// \param first Index of the first worker to steal from.
+    /// \param count Number of workers to try, going round from `first`.
+    /// \return Task to run, or nullptr if none was found.
+    Task *steal_task(std::size_t first, std::size_t count);
+
+    /// Run a task and free it.
+    ///
+    /// \param task Task to run.
+    static void run_task(Task *task) noexcept;
+
+    /// Run a piece of a parallel loop, splitting it while it is too large.
+    ///
+    /// \param state Shared loop state.
+    /// \param begin First iteration of the piece.
+    /// \param end One past the last iteration of the piece.
+    void run_range(const std::shared_ptr<LoopState> &state,
+                   std::size_t                       begin,
+                   std::size_t                       end);
+
+    /// Wake up one sleeping worker, or all of them.
+    ///
+    /// \param all True to wake up every worker.
+    void notify(bool all) noexcept;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::function<void()>                on_worker_start_;
+    std::mutex                           inject_mutex_;
+    std::deque<Task *>                   inject_queue_;
+    std::atomic<std::size_t>             inject_size_;
+    std::atomic<std::uint32_t>           signal_;
+    std::atomic<bool>                    is_stopping_;
+};
+
+} // namespace core
+
+#endif // NOHUB_CORE_SCHEDULER_H
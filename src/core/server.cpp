@@ -11,45 +11,426 @@
 //===----------------------------------------------------------------------===//
 
 #include "server.h"
+#include "datagram.h"
+#include "tracer.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <exception>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdexcept>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 namespace core {
 
-Server::Server(std::uint16_t port) {
+namespace {
+
+/// \brief Wait for poll events, spinning for a while before blocking.
+///
+/// \param fds Descriptors to poll.
+/// \param nfds Number of descriptors.
+/// \param spin_us Time to spin before blocking, in microseconds.
+/// \return Result of the last poll call.
+int poll_spin(struct pollfd *fds, nfds_t nfds, int spin_us) noexcept {
+    if (spin_us > 0) {
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::microseconds(spin_us);
+        do {
+            int ready = ::poll(fds, nfds, 0);
+            if (ready != 0) {
+                return ready;
+            }
+        } while (std::chrono::steady_clock::now() < deadline);
+    }
+
+    return ::poll(fds, nfds, -1);
+}
+
+/// \brief Split the first space-separated word off a command line.
+///
+/// \param rest Remainder of the line, advanced past the word.
+/// \return The word, without spaces or line terminator.
+std::string_view next_word(std::string_view &rest) noexcept {
+    std::string_view word = rest.substr(0, rest.find_first_of(" \r\n"));
+    rest.remove_prefix(word.size());
+    if (!rest.empty() && rest.front() == ' ') {
+        rest.remove_prefix(1);
+    }
+
+    return word;
+}
+
+/// \brief Check whether a line may be handled while the pause policy holds
+/// usage over the memory budget: it frees memory, or only costs a reply.
+///
+/// \param line The line.
+/// \return True for acknowledgements, leaves and pings.
+bool runs_while_paused(std::string_view line) noexcept {
+    std::string_view command = next_word(line);
+    return command == "/ack" || command == "/leave" || command == "/ping";
+}
+
+/// \brief Parse a "/pub <channel> <key> <value>" line.
+///
+/// \param line The line.
+/// \param channel Receives the channel name.
+/// \param key Receives the conflation key: the channel name and key, as a
+/// view into the line.
+/// \return True if the line names both a channel and a key.
+bool parse_publish(std::string_view  line,
+                   std::string_view &channel,
+                   std::string_view &key) noexcept {
+    std::string_view rest = line;
+    next_word(rest);
+    channel                = next_word(rest);
+    std::string_view value = next_word(rest);
+    if (channel.empty() || value.empty()) {
+        return false;
+    }
+
+    key = line.substr(static_cast<std::size_t>(channel.data() - line.data()),
+                      static_cast<std::size_t>(value.data() + value.size() -
+                                               channel.data()));
+    return true;
+}
+
+/// \brief Check options the server cannot run with.
+///
+/// \param options The options.
+/// \throws std::invalid_argument if an option is invalid.
+void check_options(const ServerOptions &options) {
+    for (unsigned weight : options.lane_weights) {
+        if (weight == 0) {
+            throw std::invalid_argument("lane weights must be positive");
+        }
+    }
+
+    if (options.reliable_window == 0 || options.reliable_timeout_ms <= 0) {
+        throw std::invalid_argument(
+            "reliable window and timeout must be positive");
+    }
+}
+
+/// \brief Make a timer expire periodically.
+///
+/// \param timer_fd The timerfd.
+/// \param interval Period, also the delay before the first expiration.
+/// \throws std::runtime_error if the timer cannot be set.
+void arm_timer(int timer_fd, std::chrono::milliseconds interval) {
+    struct itimerspec spec{};
+    spec.it_interval.tv_sec  = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value            = spec.it_interval;
+    if (::timerfd_settime(timer_fd, 0, &spec, nullptr) < 0) {
+        throw std::runtime_error(std::string("timerfd_settime: ") +
+                                 std::strerror(errno));
+    }
+}
+
+} // namespace
+
+Server::Server(std::uint16_t port, const ServerOptions &options)
+    : wake_fd_(-1), signal_fd_(-1), inotify_fd_(-1), timer_fd_(-1),
+      reserve_fd_(-1), is_running_(false), is_handing_off_(false),
+      fan_outs_(0), cpus_(options.cpus), next_cpu_(0),
+      options_(options),
+      client_settings_(ClientSettings{options.busy_poll_us,
+                                      options.socket_tuning,
+                                      options.bulk_threshold,
+                                      options.max_line,
+                                      options.memory_policy}),
+      memory_budget_(std::make_shared<MemoryBudget>(options.memory_budget)),
+      channel_memory_(memory_budget_),
+      connection_memory_(options.connection_memory), memory_report_time_(),
+      memory_pause_time_(),
+      max_connections_(options.max_connections),
+      max_connections_per_ip_(options.max_connections_per_ip),
+      accept_rate_(options.accept_rate),
+      accept_tokens_(std::max(1.0, options.accept_rate)),
+      accept_refill_time_(std::chrono::steady_clock::now()),
+      accept_resume_time_(), shed_count_(0),
+      shed_report_time_(), fanout_chunk_(options.fanout_chunk),
+      lane_weights_(options.lane_weights),
+      zerocopy_threshold_(options.zerocopy_threshold),
+      conflate_channels_(options.conflate_channels.begin(),
+                         options.conflate_channels.end()),
+      multicast_channels_(options.multicast_channels.begin(),
+                          options.multicast_channels.end()),
+      reliable_channels_(options.reliable_channels.begin(),
+                         options.reliable_channels.end()),
+      reliable_window_(options.reliable_window),
+      reliable_timeout_(options.reliable_timeout_ms) {
     try {
-        struct sockaddr_in server_addr{};
-        server_addr.sin_family      = AF_INET;
-        server_addr.sin_addr.s_addr = INADDR_ANY;
-        server_addr.sin_port        = htons(port);
-        this->server_socket_        = Socket(server_addr);
-        this->server_socket_.listen();
+        check_options(options);
+
+        cpu_set_t allowed;
+        if (::sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+            throw std::runtime_error(std::string("sched_getaffinity: ") +
+                                     std::strerror(errno));
+        }
+
+        for (int cpu : this->cpus_) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE ||
+                !CPU_ISSET(static_cast<std::size_t>(cpu), &allowed)) {
+                throw std::invalid_argument("cpu " + std::to_string(cpu) +
+                                            " is not available");
+            }
+        }
+
+        this->wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+        if (this->wake_fd_ < 0) {
+            throw std::runtime_error(std::string("eventfd: ") +
+                                     std::strerror(errno));
+        }
+
+        // A reload may turn tracing on, so SIGUSR1 is caught whenever the
+        // configuration can be reloaded.
+        if (options.trace_sample > 0 || options.reload ||
+            !options.record_path.empty()) {
+            // Blocked before any thread starts, so that every thread
+            // inherits the mask and the signals only reach signal_fd_.
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGUSR1);
+            if (options.reload) {
+                sigaddset(&mask, SIGHUP);
+            }
+
+            if (!options.record_path.empty()) {
+                sigaddset(&mask, SIGINT);
+                sigaddset(&mask, SIGTERM);
+            }
+
+            ::pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+            this->signal_fd_ =
+                ::signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+            if (this->signal_fd_ < 0) {
+                throw std::runtime_error(std::string("signalfd: ") +
+                                         std::strerror(errno));
+            }
+
+            Tracer::configure(options.trace_sample);
+        }
+
+        if (options.reload && !options.config_path.empty()) {
+            watch_config();
+        }
+
+        // A reload may make channels reliable, so the timer also runs
+        // whenever the configuration can be reloaded.
+        if (!options.reliable_channels.empty() || options.reload) {
+            this->timer_fd_ =
+                ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (this->timer_fd_ < 0) {
+                throw std::runtime_error(std::string("timerfd_create: ") +
+                                         std::strerror(errno));
+            }
+
+            arm_timer(this->timer_fd_, this->reliable_timeout_);
+        }
+
+        if (!options.record_path.empty()) {
+            this->recorder_ =
+                std::make_unique<SessionRecorder>(options.record_path);
+        }
+
+        if (!options.multicast_group.empty()) {
+            this->multicast_ =
+                std::make_unique<MulticastSender>(options.multicast_group,
+                                                  options.multicast_port,
+                                                  options.multicast_interface);
+        }
+
+        if (!options.takeover_path.empty()) {
+            HandoffState state   = handoff_receive(options.takeover_path);
+            this->server_socket_ = Socket(state.listen_fd);
+            this->taken_over_    = std::move(state.connections);
+            this->taken_over_sequences_ = std::move(state.sequences);
+
+            struct sockaddr_in server_addr{};
+            socklen_t          addr_len = sizeof(server_addr);
+            if (::getsockname(state.listen_fd,
+                              reinterpret_cast<struct sockaddr *>(&server_addr),
+                              &addr_len) < 0) {
+                throw std::runtime_error(std::string("getsockname: ") +
+                                         std::strerror(errno));
+            }
+
+            port = ntohs(server_addr.sin_port);
+        } else {
+            struct sockaddr_in server_addr{};
+            server_addr.sin_family      = AF_INET;
+            server_addr.sin_addr.s_addr = INADDR_ANY;
+            server_addr.sin_port        = htons(port);
+            this->server_socket_        = Socket(server_addr);
+            this->server_socket_.tune(options.socket_tuning);
+            this->server_socket_.listen();
+        }
+
+        // An inherited listener was tuned by its previous owner already.
+        this->server_socket_.set_nonblocking();
+
+        if (options.busy_poll_us > 0) {
+            try {
+                this->server_socket_.set_busy_poll(options.busy_poll_us);
+            } catch (const std::runtime_error &e) {
+                // Usually EPERM: raising it above net.core.busy_read needs
+                // CAP_NET_ADMIN. Spinning in poll_spin() still applies.
+                std::fprintf(stderr, "[-] %s\n", e.what());
+            }
+        }
+
+        if (!options.handoff_path.empty()) {
+            this->handoff_socket_ =
+                Socket(handoff_listen(options.handoff_path));
+        }
+
+        if (options.workers > 0) {
+            this->scheduler_ = std::make_shared<Scheduler>(
+                options.workers, [this]() { pin_thread(); });
+        }
+
+        // Held so that a connection can still be accepted and reset once
+        // the process is out of descriptors; without it, accepting backs
+        // off instead.
+        this->reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
         this->is_running_.store(true);
         this->port_ = port;
     } catch (const std::exception &e) {
+        for (const HandoffConnection &connection : this->taken_over_) {
+            ::close(connection.sock_fd);
+        }
+
+        if (this->wake_fd_ >= 0) {
+            ::close(this->wake_fd_);
+        }
+
+        if (this->signal_fd_ >= 0) {
+            ::close(this->signal_fd_);
+        }
+
+        if (this->inotify_fd_ >= 0) {
+            ::close(this->inotify_fd_);
+        }
+
+        if (this->timer_fd_ >= 0) {
+            ::close(this->timer_fd_);
+        }
+
+        if (this->reserve_fd_ >= 0) {
+            ::close(this->reserve_fd_);
+        }
+
         throw std::runtime_error(std::string("server constructor: ") +
                                  e.what());
     }
 }
 
-Server::~Server() { stop(); }
+Server::~Server() {
+    stop();
+    ::close(this->wake_fd_);
+    if (this->signal_fd_ >= 0) {
+        ::close(this->signal_fd_);
+        Tracer::configure(0);
+    }
+
+    if (this->inotify_fd_ >= 0) {
+        ::close(this->inotify_fd_);
+    }
+
+    if (this->timer_fd_ >= 0) {
+        ::close(this->timer_fd_);
+    }
+
+    if (this->reserve_fd_ >= 0) {
+        ::close(this->reserve_fd_);
+    }
+}
 
 std::uint16_t Server::port() const noexcept { return this->port_; }
 
 void Server::run() {
     std::printf("[*] Server running on port %d\n", this->port_);
+
+    SocketTuning tuning = this->server_socket_.tuning();
+    std::printf("[*] Socket tuning: nodelay=%d sndbuf=%d rcvbuf=%d "
+                "notsent_lowat=%d keepalive=%d (idle=%ds intvl=%ds cnt=%d)\n",
+                tuning.nodelay,
+                tuning.send_buffer,
+                tuning.recv_buffer,
+                tuning.notsent_lowat,
+                tuning.keepalive,
+                tuning.keepalive_idle,
+                tuning.keepalive_interval,
+                tuning.keepalive_count);
+
+    pin_thread();
+
+    if (!this->taken_over_.empty()) {
+        std::printf("[*] Took over %zu clients\n", this->taken_over_.size());
+        adopt_clients(this->taken_over_, this->taken_over_sequences_);
+        this->taken_over_sequences_.clear();
+    }
+
     accept_loop();
 }
 
+void Server::adopt_clients(
+    std::vector<HandoffConnection>                          &connections,
+    const std::vector<std::pair<std::string, std::uint64_t>> &sequences) {
+    std::size_t bulk_threshold = this->client_settings_.load()->bulk_threshold;
+    std::lock_guard<std::mutex> lock(this->clients_mutex_);
+    for (HandoffConnection &connection : connections) {
+        struct sockaddr_in peer_addr{};
+        socklen_t          addr_len = sizeof(peer_addr);
+        ::getpeername(connection.sock_fd,
+                      reinterpret_cast<struct sockaddr *>(&peer_addr),
+                      &addr_len);
+        try {
+            auto added = add_client(connection.sock_fd,
+                                    peer_addr.sin_addr.s_addr,
+                                    std::move(connection.buffered),
+                                    std::move(connection.outbound));
+            for (const std::string &name : connection.channels) {
+                subscribe(added, name, bulk_threshold);
+            }
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "[-] adopt_clients: %s\n", e.what());
+        }
+    }
+
+    // Numbering resumes where it was left.
+    for (const auto &[name, sequence] : sequences) {
+        Channel *channel = find_channel(name, false);
+        if (channel != nullptr) {
+            channel->sequence = sequence;
+        }
+    }
+
+    connections.clear();
+}
+
 void Server::stop() noexcept {
     if (!this->is_running_.exchange(false)) {
         return;
     }
 
+    ::eventfd_write(this->wake_fd_, 1);
     std::vector<std::thread> threads_to_join;
 
     {
@@ -62,7 +443,9 @@ void Server::stop() noexcept {
         }
 
         this->client_threads_.clear();
-        this->client_sock_fds_.clear();
+        this->connections_.clear();
+        this->channels_.clear();
+        this->ip_connections_.clear();
     }
 
     for (auto &thread : threads_to_join) {
@@ -71,20 +454,92 @@ void Server::stop() noexcept {
 }
 
 void Server::accept_loop() {
+    struct pollfd fds[7] = {
+        {this->server_socket_.sock_fd(), POLLIN, 0},
+        {this->wake_fd_, POLLIN, 0},
+        {this->handoff_socket_.sock_fd(), POLLIN, 0}, // Ignored if -1
+        {this->signal_fd_, POLLIN, 0},                // Ignored if -1
+        {this->inotify_fd_, POLLIN, 0},               // Ignored if -1
+        {this->timer_fd_, POLLIN, 0},                 // Ignored if -1
+        {this->memory_budget_->event_fd(), POLLIN, 0},
+    };
+
     try {
         while (this->is_running_.load()) {
-            int         client_sock_fd = this->server_socket_.accept();
-            std::thread client_thread(
-                &Server::client_loop, this, client_sock_fd);
+            // A backed-off listener is left out of the poll set until the
+            // backoff ends.
+            auto now        = std::chrono::steady_clock::now();
+            int  timeout_ms = -1;
+            fds[0].fd       = this->server_socket_.sock_fd();
+            if (now < this->accept_resume_time_) {
+                fds[0].fd  = -1;
+                timeout_ms = static_cast<int>(
+                    std::chrono::ceil<std::chrono::milliseconds>(
+                        this->accept_resume_time_ - now)
+                        .count());
+            }
+
+            // A pause over the budget is rechecked even when no more is
+            // charged, so that it ends in eviction if usage stays up.
+            bool pausing = this->memory_pause_time_ !=
+                           std::chrono::steady_clock::time_point{};
+            if (pausing && (timeout_ms < 0 || timeout_ms > PAUSE_CHECK_MS)) {
+                timeout_ms = PAUSE_CHECK_MS;
+            }
+
+            if (::poll(fds, 7, timeout_ms) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
 
-            {
-                std::lock_guard<std::mutex> lock(this->clients_mutex_);
-                this->client_sock_fds_.push_back(client_sock_fd);
-                this->client_threads_.emplace(client_sock_fd,
-                                              std::move(client_thread));
+                throw std::runtime_error(std::string("poll: ") +
+                                         std::strerror(errno));
             }
 
-            std::printf("[+] Client connected: fd=%d\n", client_sock_fd);
+            if (fds[1].revents != 0) {
+                break; // Server stopped
+            }
+
+            if (fds[2].revents != 0) {
+                int peer_fd;
+                try {
+                    peer_fd = handoff_accept(fds[2].fd);
+                } catch (const std::exception &e) {
+                    std::fprintf(stderr, "[-] accept_loop: %s\n", e.what());
+                    continue;
+                }
+
+                bool handed_off = hand_off(peer_fd);
+                ::close(peer_fd);
+                if (handed_off) {
+                    break;
+                }
+
+                continue; // Still serving after a failed handoff
+            }
+
+            if (fds[3].revents != 0) {
+                handle_signals();
+                if (!this->is_running_.load()) {
+                    break; // Stopped by a signal
+                }
+            }
+
+            if (fds[4].revents != 0) {
+                handle_config_change();
+            }
+
+            if (fds[5].revents != 0) {
+                retransmit();
+            }
+
+            if (fds[6].revents != 0 || pausing) {
+                shed_memory();
+            }
+
+            if (fds[0].revents != 0) {
+                accept_batch();
+            }
         }
     } catch (const std::exception &e) {
         if (this->is_running_.load()) {
@@ -93,20 +548,334 @@ void Server::accept_loop() {
     }
 }
 
-void Server::client_loop(int client_sock_fd) noexcept {
+void Server::accept_batch() {
+    std::vector<std::pair<int, std::uint32_t>> accepted;
+    struct sockaddr_in                         peer_addr{};
+
+    std::size_t unaccepted = 0;
+    while (accepted.size() + unaccepted < ACCEPT_BATCH_SIZE) {
+        int client_sock_fd = this->server_socket_.try_accept(peer_addr);
+        if (client_sock_fd < 0 && !Socket::would_block(errno)) {
+            if (shed_unaccepted(errno)) {
+                ++unaccepted;
+                continue;
+            }
+
+            break; // Out of resources, the listener backs off
+        }
+
+        if (client_sock_fd < 0) {
+            break; // Backlog drained
+        }
+
+        accepted.emplace_back(client_sock_fd, peer_addr.sin_addr.s_addr);
+    }
+
+    if (this->accept_rate_ > 0.0) {
+        auto now     = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration<double>(
+            now - this->accept_refill_time_);
+        this->accept_refill_time_ = now;
+
+        // Below one connection per second, the bucket must still hold a
+        // whole token for any connection to be admitted.
+        this->accept_tokens_ = std::min(
+            std::max(1.0, this->accept_rate_),
+            this->accept_tokens_ + elapsed.count() * this->accept_rate_);
+    }
+
+    // Admission decisions for the whole batch take the lock once; shed
+    // connections are reset outside of it.
+    std::vector<int> shed;
+    {
+        std::lock_guard<std::mutex> lock(this->clients_mutex_);
+        for (auto [client_sock_fd, peer_ip] : accepted) {
+            if (!admit(peer_ip)) {
+                shed.push_back(client_sock_fd);
+                continue;
+            }
+
+            // On failure the connection's socket has been closed already.
+            try {
+                add_client(client_sock_fd, peer_ip);
+                std::printf("[+] Client connected: fd=%d\n", client_sock_fd);
+            } catch (const std::exception &e) {
+                std::fprintf(stderr, "[-] accept_batch: %s\n", e.what());
+            }
+        }
+    }
+
+    for (int client_sock_fd : shed) {
+        Socket::abort(client_sock_fd);
+    }
+
+    // Report at most once per second, so an accept storm is not made worse
+    // by a line of output per batch.
+    this->shed_count_ += shed.size() + unaccepted;
+    auto now = std::chrono::steady_clock::now();
+    if (this->shed_count_ > 0 &&
+        now - this->shed_report_time_ >= std::chrono::seconds(1)) {
+        std::fprintf(
+            stderr, "[-] Shed %zu connections\n", this->shed_count_);
+        this->shed_count_       = 0;
+        this->shed_report_time_ = now;
+    }
+}
+
+bool Server::admit(std::uint32_t peer_ip) noexcept {
+    if (this->max_connections_ > 0 &&
+        this->client_threads_.size() >= this->max_connections_) {
+        return false;
+    }
+
+    if (this->max_connections_per_ip_ > 0) {
+        auto it = this->ip_connections_.find(peer_ip);
+        if (it != this->ip_connections_.end() &&
+            it->second >= this->max_connections_per_ip_) {
+            return false;
+        }
+    }
+
+    if (this->accept_rate_ > 0.0) {
+        if (this->accept_tokens_ < 1.0) {
+            return false;
+        }
+
+        this->accept_tokens_ -= 1.0;
+    }
+
+    return true;
+}
+
+bool Server::shed_unaccepted(int error) noexcept {
+    if ((error == EMFILE || error == ENFILE) && this->reserve_fd_ >= 0) {
+        ::close(this->reserve_fd_);
+        int client_sock_fd = ::accept4(this->server_socket_.sock_fd(),
+                                       nullptr,
+                                       nullptr,
+                                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sock_fd >= 0) {
+            Socket::abort(client_sock_fd);
+        }
+
+        this->reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (client_sock_fd >= 0) {
+            return true;
+        }
+    }
+
+    // Polling a listener that cannot be drained would spin this thread.
+    this->accept_resume_time_ = std::chrono::steady_clock::now() +
+                                std::chrono::milliseconds(ACCEPT_BACKOFF_MS);
+    return false;
+}
+
+std::shared_ptr<Connection> Server::add_client(int           client_sock_fd,
+                                               std::uint32_t peer_ip,
+                                               std::string   buffered,
+                                               std::string   outbound) {
+    auto connection = std::make_shared<Connection>(Socket(client_sock_fd),
+                                                   this->lane_weights_,
+                                                   this->zerocopy_threshold_,
+                                                   this->memory_budget_,
+                                                   this->connection_memory_);
+    connection->restore_pending(std::move(outbound));
+
+    // The thread is started under the lock so that it cannot look itself up
+    // in client_threads_ before it has been inserted.
+    ++this->ip_connections_[peer_ip];
+    this->connections_.push_back(connection);
+    this->client_threads_.emplace(client_sock_fd,
+                                  std::thread(&Server::client_loop,
+                                              this,
+                                              connection,
+                                              peer_ip,
+                                              std::move(buffered)));
+    return connection;
+}
+
+void Server::client_loop(std::shared_ptr<Connection> connection,
+                         std::uint32_t               peer_ip,
+                         std::string                 buffered) noexcept {
+    // Pin before touching any buffer, so its pages land on the local node.
+    pin_thread();
+
+    Socket &client_socket  = connection->socket();
+    int     client_sock_fd = connection->sock_fd();
+    bool    woken          = false;
+
+    LiveValue<ClientSettings>::Reader settings(this->client_settings_);
+
+    // Line received but held back while the memory budget is exceeded.
+    std::string held_line;
+
+    std::uint32_t session_client = 0;
+    if (this->recorder_ != nullptr) {
+        session_client = this->recorder_->connect();
+    }
+
     try {
-        Socket client_socket(client_sock_fd);
+        // Tuned here rather than in the accept loop to keep accepting cheap.
+        // Inherited sockets keep whatever mode their previous owner set.
+        Socket::tune(client_sock_fd, settings->socket_tuning);
+        client_socket.set_nonblocking();
+        client_socket.preload(buffered);
+
+        struct pollfd fds[3] = {
+            {client_sock_fd, POLLIN, 0},
+            {this->wake_fd_, POLLIN, 0},
+            {connection->wake_fd(), POLLIN, 0},
+        };
+
+        std::string   message;
+        std::uint64_t recv_time = 0;
         while (this->is_running_.load()) {
-            std::string message = client_socket.recv_line();
-            if (message.empty()) {
-                break; // Client disconnected
+            // Picks up a reloaded configuration without taking any lock.
+            settings.refresh();
+
+            // While the budget is exceeded under the pause policy, lines
+            // that free memory are still handled, so acknowledgements and
+            // leaves can bring usage down. The first other line is held
+            // back, and the client is read from only until a little more
+            // is buffered behind it.
+            bool paused = settings->memory_policy == ShedPolicy::PAUSE &&
+                          this->memory_budget_->exceeded();
+
+            std::size_t max_line = settings->max_line;
+            bool        too_long = false;
+            while (true) {
+                if (!held_line.empty()) {
+                    message.swap(held_line);
+                    held_line.clear();
+                } else if (!client_socket.pop_line(message)) {
+                    break;
+                }
+
+                if (max_line > 0 && message.size() > max_line) {
+                    too_long = true;
+                    break;
+                }
+
+                if (paused && !runs_while_paused(message)) {
+                    held_line.swap(message);
+                    break;
+                }
+
+                std::uint64_t trace_id = Tracer::sample();
+                if (trace_id != 0) {
+                    if (recv_time != 0) {
+                        Tracer::record(trace_id,
+                                       TraceStage::RECV,
+                                       client_sock_fd,
+                                       recv_time);
+                    }
+
+                    Tracer::record(
+                        trace_id, TraceStage::FRAMED, client_sock_fd);
+                    Tracer::set_current(trace_id);
+                }
+
+                if (this->recorder_ != nullptr) {
+                    this->recorder_->message(session_client, message);
+                }
+
+                std::printf("[+] Received from fd=%d: %s\n",
+                            client_sock_fd,
+                            message.c_str());
+
+                dispatch(connection, message, *settings);
+                if (trace_id != 0) {
+                    Tracer::set_current(0);
+                }
+            }
+
+            // Without a held line, whatever is left is a partial line, which
+            // must not grow without bound while its newline never comes.
+            if (held_line.empty() && max_line > 0 &&
+                client_socket.buffered().size() > max_line) {
+                too_long = true;
+            }
+
+            if (too_long) {
+                std::fprintf(stderr,
+                             "[-] Shed fd=%d: line over %zu bytes\n",
+                             client_sock_fd,
+                             max_line);
+                break;
+            }
+
+            if (message.capacity() > LINE_SHRINK_SIZE) {
+                std::string().swap(message);
+            }
+
+            connection->account_read(client_socket.buffer_capacity() +
+                                     message.capacity() +
+                                     held_line.capacity());
+            if (connection->has_failed()) {
+                break; // Over its memory limit
+            }
+
+            // Other threads queue output for this client and signal its
+            // wake_fd when the socket is full; writability is only watched
+            // while something is queued.
+            bool held = !held_line.empty();
+            fds[0].events =
+                held && client_socket.buffered().size() >= PAUSE_READ_SIZE
+                    ? 0
+                    : POLLIN;
+            if (connection->has_pending()) {
+                fds[0].events |= POLLOUT;
+            }
+
+            int ready = held ? ::poll(fds, 3, PAUSE_POLL_MS)
+                             : poll_spin(fds, 3, settings->busy_poll_us);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                throw std::runtime_error(std::string("poll: ") +
+                                         std::strerror(errno));
+            }
+
+            if (fds[1].revents != 0) {
+                woken = true;
+                break; // Server stopping or handing off
+            }
+
+            if (fds[2].revents != 0) {
+                connection->clear_wake();
+                if (connection->has_failed()) {
+                    break; // Sending to the client failed
+                }
+            }
+
+            // Zero-copy completions make the socket report an error until
+            // they are read from its error queue.
+            if ((fds[0].revents & POLLERR) != 0) {
+                connection->reap_zerocopy();
+            }
+
+            if ((fds[0].revents & POLLOUT) != 0) {
+                connection->flush();
+            }
+
+            if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+                continue;
+            }
+
+            ssize_t bytes_received = client_socket.recv_some();
+            if (Tracer::enabled()) {
+                recv_time = Tracer::now();
             }
 
-            std::printf("[+] Received from fd=%d: %s\n",
-                        client_sock_fd,
-                        message.c_str());
+            if (bytes_received < 0 && Socket::would_block(errno)) {
+                continue; // Spurious wakeup
+            }
 
-            broadcast(message, client_sock_fd);
+            if (bytes_received <= 0) {
+                break; // Client disconnected
+            }
         }
     } catch (const std::exception &e) {
         if (this->is_running_.load()) {
@@ -117,38 +886,936 @@ void Server::client_loop(int client_sock_fd) noexcept {
         }
     }
 
+    bool handed_off = woken && this->is_handing_off_.load();
+
     {
         std::lock_guard<std::mutex> lock(this->clients_mutex_);
-        this->client_sock_fds_.erase(std::remove(this->client_sock_fds_.begin(),
-                                                 this->client_sock_fds_.end(),
-                                                 client_sock_fd),
-                                     this->client_sock_fds_.end());
+        this->connections_.erase(std::remove(this->connections_.begin(),
+                                             this->connections_.end(),
+                                             connection),
+                                 this->connections_.end());
 
         auto it = this->client_threads_.find(client_sock_fd);
         if (it != this->client_threads_.end()) {
+            // Destroying a joinable std::thread terminates the process.
+            it->second.detach();
             this->client_threads_.erase(it);
         }
+
+        auto ip_it = this->ip_connections_.find(peer_ip);
+        if (ip_it != this->ip_connections_.end() && --ip_it->second == 0) {
+            this->ip_connections_.erase(ip_it);
+        }
+
+        std::vector<std::string> channels = unsubscribe_all(connection);
+
+        // No broadcast can queue more output once the connection is gone
+        // from connections_ and its channels, and those already under way
+        // are waited for, so everything pending moves to the successor.
+        if (handed_off) {
+            wait_for_fan_outs();
+
+            HandoffConnection parked;
+            parked.buffered = std::move(held_line);
+            parked.buffered.append(client_socket.buffered());
+            parked.outbound = connection->take_pending();
+            parked.channels = std::move(channels);
+            parked.sock_fd  = client_socket.release();
+            this->handed_off_.push_back(std::move(parked));
+
+            // Its error queue went with the socket, so zero-copy sends still
+            // in flight are never reported; their frames must outlive the
+            // handoff.
+            this->retired_.push_back(connection);
+        }
     }
 
-    ::close(client_sock_fd);
-    std::printf("[-] Client disconnected: fd=%d\n", client_sock_fd);
+    if (!handed_off) {
+        if (this->recorder_ != nullptr) {
+            this->recorder_->disconnect(session_client);
+        }
+
+        if (connection->was_shed()) {
+            std::fprintf(stderr,
+                         "[-] Shed fd=%d to free memory\n",
+                         client_sock_fd);
+        }
+
+        struct tcp_info info{};
+        Socket::tcp_info(client_sock_fd, info);
+        std::printf("[-] Client disconnected: fd=%d (rtt=%uus retrans=%u)\n",
+                    client_sock_fd,
+                    info.tcpi_rtt,
+                    info.tcpi_total_retrans);
+    }
 }
 
-void Server::broadcast(const std::string_view message,
-                       int                    exclude_sock_fd) noexcept {
-    std::lock_guard<std::mutex> lock(this->clients_mutex_);
-    for (int client_sock_fd : this->client_sock_fds_) {
-        if (client_sock_fd != exclude_sock_fd) {
-            ssize_t sent = ::send(client_sock_fd,
-                                  std::string(message).c_str(),
-                                  message.size(),
-                                  0);
-            if (sent < 0) {
-                std::fprintf(stderr,
-                             "[-] broadcast: send failed (fd=%d)\n",
-                             client_sock_fd);
+void Server::dispatch(const std::shared_ptr<Connection> &connection,
+                      const std::string                 &line,
+                      const ClientSettings              &settings) noexcept {
+    try {
+        std::string_view rest(line);
+        std::string_view command = next_word(rest);
+
+        // Whatever a client sends goes on a lane chosen by its size, so a
+        // large payload never gets ahead of traffic on the control lane.
+        Lane lane = line.size() >= settings.bulk_threshold ? Lane::BULK
+                                                           : Lane::NORMAL;
+
+        // Pings are answered to the sender alone, on the control lane unless
+        // they carry a bulk payload, so they measure latency without waiting
+        // behind queued messages.
+        if (command == "/ping") {
+            connection->send(
+                lane == Lane::NORMAL ? Lane::CONTROL : lane,
+                std::make_shared<const std::string>("/pong" + line.substr(5)));
+            return;
+        }
+
+        if (command == "/join" || command == "/leave") {
+            std::string name(next_word(rest));
+            if (name.empty()) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(this->clients_mutex_);
+            if (command == "/join") {
+                subscribe(connection, name, settings.bulk_threshold);
+            } else {
+                unsubscribe(connection, name);
+            }
+
+            return;
+        }
+
+        if (command == "/ack" || command == "/resend") {
+            std::string      name(next_word(rest));
+            std::string_view number   = next_word(rest);
+            std::uint64_t    sequence = 0;
+            auto [end, ec]            = std::from_chars(
+                number.data(), number.data() + number.size(), sequence);
+            if (name.empty() || ec != std::errc()) {
+                return;
             }
+
+            std::lock_guard<std::mutex> lock(this->clients_mutex_);
+            acknowledge(connection, command, name, sequence);
+            return;
+        }
+
+        if (command == "/pub") {
+            publish(*connection, line, settings.bulk_threshold);
+            return;
         }
+
+        broadcast(line, connection->sock_fd(), lane);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr,
+                     "[-] dispatch(fd=%d): %s\n",
+                     connection->sock_fd(),
+                     e.what());
+    }
+}
+
+void Server::subscribe(const std::shared_ptr<Connection> &connection,
+                       const std::string                 &name,
+                       std::size_t                        bulk_threshold) {
+    Channel &channel     = *find_channel(name, true);
+    auto    &subscribers = channel.subscribers;
+    if (std::find(subscribers.begin(), subscribers.end(), connection) !=
+        subscribers.end()) {
+        return;
+    }
+
+    subscribers.push_back(connection);
+
+    // A new subscriber catches up with one frame per key, however many
+    // updates were published before it joined.
+    for (const auto &[key, value] : channel.last_values) {
+        const Frame     &frame = value.frame;
+        std::string_view channel_name;
+        std::string_view conflation_key;
+        parse_publish(*frame, channel_name, conflation_key);
+
+        Lane lane =
+            frame->size() >= bulk_threshold ? Lane::BULK : Lane::NORMAL;
+        connection->send(lane, frame, conflation_key);
+    }
+}
+
+void Server::unsubscribe(const std::shared_ptr<Connection> &connection,
+                         const std::string                 &name) {
+    auto it = this->channels_.find(name);
+    if (it == this->channels_.end()) {
+        return;
+    }
+
+    auto &subscribers = it->second.subscribers;
+    subscribers.erase(
+        std::remove(subscribers.begin(), subscribers.end(), connection),
+        subscribers.end());
+    it->second.windows.erase(connection.get());
+
+    if (subscribers.empty() && !it->second.is_persistent()) {
+        this->channels_.erase(it);
+    }
+}
+
+std::vector<std::string>
+Server::unsubscribe_all(const std::shared_ptr<Connection> &connection) {
+    std::vector<std::string> names;
+
+    for (auto it = this->channels_.begin(); it != this->channels_.end();) {
+        auto &subscribers = it->second.subscribers;
+        auto  found =
+            std::find(subscribers.begin(), subscribers.end(), connection);
+        if (found != subscribers.end()) {
+            names.push_back(it->first);
+            subscribers.erase(found);
+            it->second.windows.erase(connection.get());
+        }
+
+        if (subscribers.empty() && !it->second.is_persistent()) {
+            it = this->channels_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return names;
+}
+
+void Server::publish(const Connection  &connection,
+                     const std::string &line,
+                     std::size_t        bulk_threshold) {
+    std::string_view name;
+    std::string_view key;
+    if (!parse_publish(line, name, key)) {
+        return;
+    }
+
+    // The conflation key must view the frame itself, which outlives the
+    // line in every queue holding it.
+    Frame frame = std::make_shared<const std::string>(line);
+    std::string_view frame_key(frame->data() + (key.data() - line.data()),
+                               key.size());
+    Lane lane = frame->size() >= bulk_threshold ? Lane::BULK : Lane::NORMAL;
+
+    std::unique_lock<std::mutex> lock(this->clients_mutex_);
+
+    Channel *channel = find_channel(std::string(name), false);
+    if (channel == nullptr) {
+        return; // Nobody listening, nothing to remember
+    }
+
+    if (!channel->conflate) {
+        frame_key = std::string_view();
+    } else {
+        channel->last_values.insert_or_assign(
+            std::string(key.substr(name.size() + 1)),
+            LastValue{frame,
+                      MemoryCharge(this->channel_memory_,
+                                   MemoryKind::HISTORY,
+                                   frame->size())});
+    }
+
+    if (channel->multicast || channel->reliable) {
+        ++channel->sequence;
+    }
+
+    // Numbered under the lock but sent after releasing it, so that the
+    // other client threads do not wait on sendmsg(). Datagrams of
+    // concurrent publishers may then leave out of order, which UDP does
+    // not rule out anyway.
+    std::uint64_t multicast_sequence = 0;
+    Frame         multicast_frame;
+    if (channel->multicast) {
+        multicast_sequence = channel->sequence;
+        multicast_frame    = frame;
+    }
+
+    if (channel->reliable) {
+        // A single lane keeps the channel's messages in sequence order, so
+        // that subscribers only see gaps where messages were really lost.
+        frame = std::make_shared<const std::string>(
+            "/seq " + std::string(name) + " " +
+            std::to_string(channel->sequence) + " " + line);
+        lane = Lane::NORMAL;
+
+        // Kept before being sent, so a message whose sending fails can
+        // still be sent again.
+        auto now = std::chrono::steady_clock::now();
+        for (const auto &subscriber : channel->subscribers) {
+            if (subscriber->sock_fd() == connection.sock_fd()) {
+                continue;
+            }
+
+            Window &window = channel->windows[subscriber.get()];
+            if (window.size() >= this->reliable_window_) {
+                window.pop_front(); // Reported as lost if asked for again
+            }
+
+            window.push_back({channel->sequence,
+                              frame,
+                              now,
+                              MemoryCharge(subscriber->memory(),
+                                           MemoryKind::HISTORY,
+                                           frame->size())});
+        }
+    }
+
+    // Subscribers of a reliable channel would take a late frame for a lost
+    // one, and those of a conflated channel could keep a stale value.
+    fan_out(lock,
+            channel->subscribers,
+            frame,
+            connection.sock_fd(),
+            lane,
+            frame_key,
+            channel->reliable || channel->conflate ? channel->order : nullptr);
+
+    // The cost is one datagram, however many hosts listen to the group.
+    if (multicast_sequence != 0 &&
+        !this->multicast_->send(multicast_sequence, *multicast_frame)) {
+        std::fprintf(stderr,
+                     "[-] publish: datagram %llu dropped\n",
+                     static_cast<unsigned long long>(multicast_sequence));
+    }
+}
+
+void Server::acknowledge(const std::shared_ptr<Connection> &connection,
+                         std::string_view                   command,
+                         const std::string                 &name,
+                         std::uint64_t                      sequence) {
+    auto channel_it = this->channels_.find(name);
+    if (channel_it == this->channels_.end()) {
+        return;
+    }
+
+    Channel &channel = channel_it->second;
+    auto     it      = channel.windows.find(connection.get());
+    if (it == channel.windows.end()) {
+        return;
+    }
+
+    Window &window = it->second;
+    if (command == "/ack") {
+        while (!window.empty() && window.front().sequence <= sequence) {
+            window.pop_front();
+        }
+
+        return;
+    }
+
+    // Messages older than the window cannot be sent again; the subscriber
+    // is told to skip them, on the lane of the messages themselves.
+    std::uint64_t first =
+        window.empty() ? channel.sequence + 1 : window.front().sequence;
+    if (sequence < first) {
+        connection->send(Lane::NORMAL,
+                         std::make_shared<const std::string>(
+                             "/lost " + name + " " + std::to_string(sequence) +
+                             " " + std::to_string(first - 1) + "\n"));
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (Unacked &unacked : window) {
+        if (unacked.sequence >= sequence) {
+            connection->send(Lane::NORMAL, unacked.frame);
+            unacked.sent_time = now;
+        }
+    }
+}
+
+void Server::retransmit() noexcept {
+    std::uint64_t expirations;
+    while (::read(this->timer_fd_, &expirations, sizeof(expirations)) > 0) {
+    }
+
+    // Collected under the lock and sent after releasing it, so that
+    // queueing them does not hold up the other client threads.
+    std::vector<std::pair<std::shared_ptr<Connection>, Frame>> resends;
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(this->clients_mutex_);
+        for (auto &[name, channel] : this->channels_) {
+            if (!channel.reliable) {
+                continue;
+            }
+
+            for (const auto &subscriber : channel.subscribers) {
+                auto it = channel.windows.find(subscriber.get());
+                if (it == channel.windows.end() || it->second.empty()) {
+                    continue;
+                }
+
+                const Unacked &oldest = it->second.front();
+                unsigned       backoff =
+                    std::min(oldest.retries, RETRANSMIT_MAX_BACKOFF);
+                if (now - oldest.sent_time <
+                    this->reliable_timeout_ * (1 << backoff)) {
+                    continue;
+                }
+
+                // Messages still queued are not lost, merely slow: a
+                // backed-up subscriber would only get more behind.
+                if (subscriber->has_pending()) {
+                    continue;
+                }
+
+                std::size_t count =
+                    std::min(it->second.size(), RETRANSMIT_BURST);
+                for (std::size_t i = 0; i < count; ++i) {
+                    Unacked &unacked  = it->second[i];
+                    unacked.sent_time = now;
+                    ++unacked.retries;
+                    resends.emplace_back(subscriber, unacked.frame);
+                }
+            }
+        }
+    }
+
+    for (const auto &[subscriber, frame] : resends) {
+        try {
+            subscriber->send(Lane::NORMAL, frame);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "[-] retransmit: %s\n", e.what());
+        }
+    }
+}
+
+Server::Channel *Server::find_channel(const std::string &name, bool create) {
+    auto it = this->channels_.find(name);
+    if (it != this->channels_.end()) {
+        return &it->second;
+    }
+
+    Channel channel;
+    channel.reliable = this->reliable_channels_.contains(name);
+    channel.conflate =
+        !channel.reliable && this->conflate_channels_.contains(name);
+    channel.multicast =
+        this->multicast_ && this->multicast_channels_.contains(name);
+    if (!create && !channel.is_persistent()) {
+        return nullptr;
+    }
+
+    return &this->channels_.emplace(name, std::move(channel)).first->second;
+}
+
+void Server::watch_config() {
+    // Editors often replace the file rather than rewrite it, so the
+    // directory is watched and events are matched on the file name.
+    const std::string &path      = this->options_.config_path;
+    std::size_t        slash     = path.rfind('/');
+    std::string        directory = ".";
+    if (slash != std::string::npos) {
+        directory = path.substr(0, slash + 1);
+    }
+
+    this->config_name_ = path.substr(slash + 1); // npos + 1 == 0
+
+    this->inotify_fd_ = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (this->inotify_fd_ < 0) {
+        throw std::runtime_error(std::string("inotify_init1: ") +
+                                 std::strerror(errno));
+    }
+
+    if (::inotify_add_watch(this->inotify_fd_,
+                            directory.c_str(),
+                            IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        throw std::runtime_error(std::string("inotify_add_watch: ") +
+                                 std::strerror(errno));
+    }
+}
+
+void Server::handle_signals() noexcept {
+    // Drain every queued signal; one dump or reload covers them all.
+    bool                    dump      = false;
+    bool                    reload    = false;
+    bool                    terminate = false;
+    struct signalfd_siginfo info;
+    while (::read(this->signal_fd_, &info, sizeof(info)) > 0) {
+        dump      = dump || info.ssi_signo == SIGUSR1;
+        reload    = reload || info.ssi_signo == SIGHUP;
+        terminate = terminate || info.ssi_signo == SIGINT ||
+                    info.ssi_signo == SIGTERM;
+    }
+
+    if (terminate) {
+        std::printf("[*] Stopping\n");
+        stop();
+        return;
+    }
+
+    if (reload) {
+        reload_config();
+    }
+
+    if (dump) {
+        dump_trace();
+    }
+}
+
+void Server::handle_config_change() noexcept {
+    alignas(struct inotify_event) char buffer[4096];
+    bool                               changed = false;
+
+    ssize_t bytes_read;
+    while ((bytes_read = ::read(this->inotify_fd_, buffer, sizeof(buffer))) >
+           0) {
+        for (ssize_t offset = 0; offset < bytes_read;) {
+            const auto *event =
+                reinterpret_cast<const struct inotify_event *>(buffer + offset);
+            changed = changed ||
+                      (event->len > 0 && this->config_name_ == event->name);
+            offset += static_cast<ssize_t>(sizeof(*event) + event->len);
+        }
+    }
+
+    if (changed) {
+        reload_config();
+    }
+}
+
+void Server::shed_memory() noexcept {
+    this->memory_budget_->clear_event();
+
+    std::size_t limit = this->memory_budget_->limit();
+    std::size_t used  = this->memory_budget_->used();
+    if (limit == 0 || used <= limit) {
+        this->memory_pause_time_ = {};
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->clients_mutex_);
+
+    // Staying over the budget signals again on every charge, so the
+    // breakdown is reported at most once per second.
+    auto now    = std::chrono::steady_clock::now();
+    bool report = now - this->memory_report_time_ >= std::chrono::seconds(1);
+    if (report) {
+        std::size_t read     = 0;
+        std::size_t outbound = 0;
+        std::size_t history  = this->channel_memory_.used();
+        for (const auto &connection : this->connections_) {
+            read += connection->memory().used(MemoryKind::READ);
+            outbound += connection->memory().used(MemoryKind::OUTBOUND);
+            history += connection->memory().used(MemoryKind::HISTORY);
+        }
+
+        std::fprintf(stderr,
+                     "[-] Memory budget exceeded: %zu of %zu bytes (read %zu, "
+                     "outbound %zu, history %zu)\n",
+                     used,
+                     limit,
+                     read,
+                     outbound,
+                     history);
+        this->memory_report_time_ = now;
+    }
+
+    // Client threads hold back lines until usage drops, but if it does not
+    // within PAUSE_EVICT_MS, the largest holders are evicted after all.
+    if (this->client_settings_.load()->memory_policy == ShedPolicy::PAUSE) {
+        if (this->memory_pause_time_ ==
+            std::chrono::steady_clock::time_point{}) {
+            this->memory_pause_time_ = now;
+        }
+
+        if (now - this->memory_pause_time_ <
+            std::chrono::milliseconds(PAUSE_EVICT_MS)) {
+            return;
+        }
+
+        if (report) {
+            std::fprintf(stderr,
+                         "[-] Memory still over budget after %d ms of pause; "
+                         "evicting\n",
+                         PAUSE_EVICT_MS);
+        }
+    }
+
+    // The last values of conflated channels stay however many clients go,
+    // so evicting cannot help when they alone exceed the budget.
+    std::size_t channel_bytes = this->channel_memory_.used();
+    if (channel_bytes >= limit) {
+        if (report) {
+            std::fprintf(stderr,
+                         "[-] Channel history alone holds %zu bytes; no "
+                         "client evicted\n",
+                         channel_bytes);
+        }
+
+        return;
+    }
+
+    // What shed clients hold is released once their threads exit, so it is
+    // not counted again. The largest remaining holders go first, until what
+    // they hold would bring usage back under the limit.
+    std::vector<std::pair<std::size_t, std::shared_ptr<Connection>>> holders;
+    holders.reserve(this->connections_.size());
+    for (const auto &connection : this->connections_) {
+        std::size_t bytes = connection->memory().used();
+        if (connection->was_shed()) {
+            used -= std::min(bytes, used);
+        } else {
+            holders.emplace_back(bytes, connection);
+        }
+    }
+
+    std::sort(holders.begin(),
+              holders.end(),
+              [](const auto &a, const auto &b) { return a.first > b.first; });
+    for (const auto &[bytes, connection] : holders) {
+        if (used <= limit || bytes == 0) {
+            break;
+        }
+
+        connection->shed();
+        used -= std::min(bytes, used);
+    }
+}
+
+void Server::dump_trace() noexcept {
+    try {
+        std::size_t events = Tracer::dump(this->options_.trace_path);
+        std::printf("[*] Wrote %zu trace events to %s\n",
+                    events,
+                    this->options_.trace_path.c_str());
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "[-] dump_trace: %s\n", e.what());
+    }
+}
+
+void Server::reload_config() noexcept {
+    ServerOptions options;
+    try {
+        options = this->options_.reload();
+        check_options(options);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "[-] reload: %s\n", e.what());
+        return;
+    }
+
+    // Settings baked into threads and sockets at startup stay as they are.
+    const ServerOptions &current = this->options_;
+    if (options.cpus != current.cpus) {
+        std::fprintf(stderr, "[-] reload: cpus only change on restart\n");
+    }
+
+    if (options.handoff_path != current.handoff_path) {
+        std::fprintf(stderr, "[-] reload: handoff only changes on restart\n");
+    }
+
+    if (options.multicast_group != current.multicast_group ||
+        options.multicast_port != current.multicast_port ||
+        options.multicast_interface != current.multicast_interface) {
+        std::fprintf(stderr,
+                     "[-] reload: multicast egress only changes on restart\n");
+    }
+
+    // A new pool is started before the lock is taken, and the old one
+    // joined after it is released, so fan-out never waits on either. Fan-outs
+    // still running on the old pool keep it until they are done.
+    std::shared_ptr<Scheduler> scheduler;
+    bool resize_pool = options.workers != current.workers;
+    if (resize_pool && options.workers > 0) {
+        try {
+            scheduler = std::make_shared<Scheduler>(
+                options.workers, [this]() { pin_thread(); });
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "[-] reload: %s\n", e.what());
+            return;
+        }
+    }
+
+    this->client_settings_.store(ClientSettings{options.busy_poll_us,
+                                                options.socket_tuning,
+                                                options.bulk_threshold,
+                                                options.max_line,
+                                                options.memory_policy});
+    this->memory_budget_->set_limit(options.memory_budget);
+    Tracer::configure(options.trace_sample);
+
+    // Admission settings are only read by this thread.
+    auto now = std::chrono::steady_clock::now();
+    if (options.accept_rate != current.accept_rate) {
+        double burst = std::max(1.0, options.accept_rate);
+        this->accept_tokens_ =
+            current.accept_rate > 0.0 ? std::min(this->accept_tokens_, burst)
+                                      : burst;
+        this->accept_refill_time_ = now;
+    }
+
+    this->max_connections_        = options.max_connections;
+    this->max_connections_per_ip_ = options.max_connections_per_ip;
+    this->accept_rate_            = options.accept_rate;
+
+    {
+        std::lock_guard<std::mutex> lock(this->clients_mutex_);
+        this->fanout_chunk_       = options.fanout_chunk;
+        this->lane_weights_       = options.lane_weights;
+        this->zerocopy_threshold_ = options.zerocopy_threshold;
+        this->connection_memory_  = options.connection_memory;
+        this->conflate_channels_  = std::unordered_set<std::string>(
+            options.conflate_channels.begin(), options.conflate_channels.end());
+        this->multicast_channels_ =
+            std::unordered_set<std::string>(options.multicast_channels.begin(),
+                                            options.multicast_channels.end());
+        this->reliable_channels_ =
+            std::unordered_set<std::string>(options.reliable_channels.begin(),
+                                            options.reliable_channels.end());
+        this->reliable_window_  = options.reliable_window;
+        this->reliable_timeout_ =
+            std::chrono::milliseconds(options.reliable_timeout_ms);
+        if (resize_pool) {
+            std::swap(this->scheduler_, scheduler);
+        }
+
+        // Channels that stop being conflated or reliable drop their last
+        // values or unacknowledged messages, and are forgotten once nobody
+        // listens.
+        for (auto it = this->channels_.begin(); it != this->channels_.end();) {
+            Channel &channel  = it->second;
+            channel.reliable  = this->reliable_channels_.contains(it->first);
+            channel.conflate  = !channel.reliable &&
+                               this->conflate_channels_.contains(it->first);
+            channel.multicast = this->multicast_ &&
+                                this->multicast_channels_.contains(it->first);
+            if (!channel.conflate) {
+                channel.last_values.clear();
+            }
+
+            if (!channel.reliable) {
+                channel.windows.clear();
+            }
+
+            if (channel.subscribers.empty() && !channel.is_persistent()) {
+                it = this->channels_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    scheduler.reset();
+
+    if (options.reliable_timeout_ms != current.reliable_timeout_ms) {
+        try {
+            arm_timer(this->timer_fd_, this->reliable_timeout_);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "[-] reload: %s\n", e.what());
+        }
+    }
+
+    // Restart-only settings keep their running values, so the warnings
+    // above are repeated on every reload until a restart applies them.
+    options.cpus                = current.cpus;
+    options.handoff_path        = current.handoff_path;
+    options.multicast_group     = current.multicast_group;
+    options.multicast_port      = current.multicast_port;
+    options.multicast_interface = current.multicast_interface;
+    options.takeover_path       = current.takeover_path;
+    options.config_path         = current.config_path;
+    options.reload              = current.reload;
+    this->options_              = std::move(options);
+    std::printf("[*] Reloaded configuration\n");
+}
+
+void Server::pin_thread() noexcept {
+    if (this->cpus_.empty()) {
+        return;
+    }
+
+    int cpu = this->cpus_[this->next_cpu_.fetch_add(1) % this->cpus_.size()];
+
+    // The constructor checked that every CPU is within the set.
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(static_cast<std::size_t>(cpu), &cpu_set);
+    int err =
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (err != 0) {
+        std::fprintf(
+            stderr, "[-] pin_thread(cpu=%d): %s\n", cpu, std::strerror(err));
+        return;
+    }
+
+    // New pages go to the node of the thread first touching them; asking for
+    // MPOL_LOCAL keeps that true even under an inherited interleave policy.
+    // Failure (e.g. ENOSYS without NUMA support) leaves the default policy.
+    ::syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0UL);
+}
+
+bool Server::hand_off(int peer_fd) noexcept {
+    std::printf("[*] Handing off to successor\n");
+    this->is_handing_off_.store(true);
+
+    // Client threads park their connections in handed_off_ when woken,
+    // leaving the sockets open for the successor.
+    std::vector<std::thread> threads_to_join;
+    {
+        std::lock_guard<std::mutex> lock(this->clients_mutex_);
+        for (auto &[sock_fd, thread] : this->client_threads_) {
+            if (thread.joinable()) {
+                threads_to_join.push_back(std::move(thread));
+            }
+        }
+
+        this->client_threads_.clear();
+    }
+
+    ::eventfd_write(this->wake_fd_, 1);
+    for (auto &thread : threads_to_join) {
+        thread.join();
+    }
+
+    HandoffState state;
+    state.listen_fd   = this->server_socket_.sock_fd();
+    state.connections = std::move(this->handed_off_);
+    this->handed_off_.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(this->clients_mutex_);
+        for (const auto &[name, channel] : this->channels_) {
+            if (channel.sequence > 0) {
+                state.sequences.emplace_back(name, channel.sequence);
+            }
+        }
+    }
+
+    try {
+        handoff_send(peer_fd, state);
+        std::printf("[*] Handed off %zu clients\n", state.connections.size());
+    } catch (const std::exception &e) {
+        std::fprintf(stderr,
+                     "[-] hand_off: %s; serving %zu clients again\n",
+                     e.what(),
+                     state.connections.size());
+
+        // The wake event is consumed first, or the restarted client threads
+        // would exit at once.
+        eventfd_t value;
+        ::eventfd_read(this->wake_fd_, &value);
+        this->is_handing_off_.store(false);
+        try {
+            adopt_clients(state.connections, state.sequences);
+        } catch (const std::exception &adopt_error) {
+            std::fprintf(stderr, "[-] hand_off: %s\n", adopt_error.what());
+        }
+
+        return false;
+    }
+
+    // Closing our copies does not affect the successor's descriptors.
+    for (const HandoffConnection &connection : state.connections) {
+        ::close(connection.sock_fd);
+    }
+
+    this->is_running_.store(false);
+    return true;
+}
+
+void Server::broadcast(const std::string_view message,
+                       int                    exclude_sock_fd,
+                       Lane                   lane) noexcept {
+    // One copy of the message is shared by every recipient's queue.
+    Frame frame;
+    try {
+        frame = std::make_shared<const std::string>(message);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "[-] broadcast: %s\n", e.what());
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(this->clients_mutex_);
+    fan_out(lock, this->connections_, frame, exclude_sock_fd, lane, {}, {});
+}
+
+void Server::fan_out(
+    std::unique_lock<std::mutex>                   &lock,
+    const std::vector<std::shared_ptr<Connection>> &recipients,
+    const Frame                                    &frame,
+    int                                             exclude_sock_fd,
+    Lane                                            lane,
+    std::string_view                                key,
+    const std::shared_ptr<FanOutOrder>             &order) noexcept {
+    // The copy keeps every recipient alive, and its socket open, until the
+    // frame is queued.
+    std::vector<std::shared_ptr<Connection>> snapshot;
+    try {
+        snapshot = recipients;
+    } catch (const std::exception &e) {
+        lock.unlock();
+        std::fprintf(stderr, "[-] broadcast: %s\n", e.what());
+        return;
+    }
+
+    std::shared_ptr<FanOutOrder> turn      = order;
+    std::uint64_t                ticket    = turn ? ++turn->started : 0;
+    std::shared_ptr<Scheduler>   scheduler = this->scheduler_;
+    std::size_t                  chunk     = this->fanout_chunk_;
+    this->fan_outs_.fetch_add(1, std::memory_order_acq_rel);
+    lock.unlock();
+
+    // An ordered fan-out waits for the one started before it.
+    if (turn) {
+        std::uint64_t finished =
+            turn->finished.load(std::memory_order_acquire);
+        while (finished != ticket - 1) {
+            turn->finished.wait(finished, std::memory_order_acquire);
+            finished = turn->finished.load(std::memory_order_acquire);
+        }
+    }
+
+    std::uint64_t trace_id = Tracer::enabled() ? Tracer::current() : 0;
+    if (trace_id != 0) {
+        Tracer::record(trace_id, TraceStage::ROUTED, -1);
+    }
+
+    auto send_range = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            Connection &connection = *snapshot[i];
+            if (connection.sock_fd() == exclude_sock_fd) {
+                continue;
+            }
+
+            // Never blocks: what the socket cannot take stays queued on the
+            // connection, and its own thread sends it once there is room.
+            try {
+                connection.send(lane, frame, key, trace_id);
+            } catch (const std::exception &) {
+                std::fprintf(stderr,
+                             "[-] broadcast: send failed (fd=%d)\n",
+                             connection.sock_fd());
+            }
+        }
+    };
+
+    if (scheduler) {
+        scheduler->parallel_for(snapshot.size(), chunk, send_range);
+    } else {
+        send_range(0, snapshot.size());
+    }
+
+    if (turn) {
+        turn->finished.store(ticket, std::memory_order_release);
+        turn->finished.notify_all();
+    }
+
+    // A connection parked for a handoff waits for this, so that nothing is
+    // queued for it once its pending output went to the successor.
+    if (this->fan_outs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->fan_outs_.notify_all();
+    }
+}
+
+void Server::wait_for_fan_outs() noexcept {
+    std::size_t running = this->fan_outs_.load(std::memory_order_acquire);
+    while (running != 0) {
+        this->fan_outs_.wait(running, std::memory_order_acquire);
+        running = this->fan_outs_.load(std::memory_order_acquire);
     }
 }
 
@@ -13,24 +13,168 @@
 #ifndef NOHUB_CORE_SERVER_H
 #define NOHUB_CORE_SERVER_H
 
+#include "connection.h"
+#include "datagram.h"
+#include "handoff.h"
+#include "live_value.h"
+#include "memory_budget.h"
+#include "scheduler.h"
+#include "session_trace.h"
 #include "socket.h"
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace core {
 
+/// \brief Optional server features.
+struct ServerOptions {
+    /// Unix socket path on which a successor process can take over the
+    /// server (empty to disable hot restarts).
+    std::string handoff_path = std::string();
+
+    /// Unix socket path of a running server whose sockets are taken over
+    /// instead of binding a new listening socket (empty to start fresh).
+    std::string takeover_path = std::string();
+
+    /// CPUs the server threads are pinned to, assigned round-robin (empty to
+    /// leave placement to the scheduler).
+    std::vector<int> cpus = {};
+
+    /// Time in microseconds a client thread spins waiting for data before
+    /// blocking, also applied as SO_BUSY_POLL (0 to disable busy polling).
+    int busy_poll_us = 0;
+
+    /// Maximum number of connected clients (0 for no limit).
+    std::size_t max_connections = 0;
+
+    /// Maximum number of connected clients per IP address (0 for no limit).
+    std::size_t max_connections_per_ip = 0;
+
+    /// Sustained number of connections admitted per second, with bursts of up
+    /// to one second worth of connections, and at least one (0 for no
+    /// limit).
+    double accept_rate = 0.0;
+
+    /// Options applied to the listening socket and every client socket.
+    SocketTuning socket_tuning = SocketTuning();
+
+    /// Number of worker threads sharing the fan-out of broadcasts (0 to
+    /// broadcast from the sending client's thread only).
+    std::size_t workers = 0;
+
+    /// Largest number of recipients a single worker task sends to.
+    std::size_t fanout_chunk = 64;
+
+    /// Frames sent to a client from the control, normal and bulk lanes per
+    /// scheduling round.
+    LaneWeights lane_weights = {8, 4, 1};
+
+    /// Size in bytes from which a message is sent on the bulk lane.
+    std::size_t bulk_threshold = 4096;
+
+    /// Size in bytes from which a message is sent to clients with
+    /// MSG_ZEROCOPY instead of being copied into each socket buffer (0 to
+    /// disable). Only pays off for large messages, around 10 KiB and up.
+    std::size_t zerocopy_threshold = 0;
+
+    /// Channels keeping the last value published for each key. Updates
+    /// still queued for a subscriber are replaced by newer ones, and new
+    /// subscribers receive the current values when joining.
+    std::vector<std::string> conflate_channels = {};
+
+    /// Multicast group each message published to a multicast channel is
+    /// also sent to once, as a numbered UDP datagram (empty to disable).
+    std::string multicast_group = std::string();
+
+    /// Destination port of multicast datagrams.
+    std::uint16_t multicast_port = 5700;
+
+    /// Address of the interface multicast datagrams leave from (empty for
+    /// the default route).
+    std::string multicast_interface = std::string();
+
+    /// Channels whose messages are sent to the multicast group.
+    std::vector<std::string> multicast_channels = {};
+
+    /// Channels delivered at least once: messages are numbered, subscribers
+    /// acknowledge them, and unacknowledged ones are sent again. Reliable
+    /// channels are never conflated.
+    std::vector<std::string> reliable_channels = {};
+
+    /// Largest number of unacknowledged messages kept per subscriber of a
+    /// reliable channel; older ones are given up on.
+    std::size_t reliable_window = 4096;
+
+    /// Time in milliseconds after which unacknowledged messages are sent
+    /// again to a subscriber whose queue has drained.
+    int reliable_timeout_ms = 1000;
+
+    /// Longest line accepted from a client, newline included; a client
+    /// sending a longer one is disconnected (0 for no limit).
+    std::size_t max_line = 1024 * 1024;
+
+    /// Bytes a client may hold in its receive buffer, its queued frames and
+    /// its unacknowledged messages before it is disconnected (0 for no
+    /// limit).
+    std::size_t connection_memory = 0;
+
+    /// Bytes the server may hold in receive buffers, queued frames and
+    /// channel history across all clients (0 for no limit). A frame queued
+    /// for several clients counts once per client.
+    std::size_t memory_budget = 0;
+
+    /// What to do while memory_budget is exceeded: disconnect the clients
+    /// holding the most memory, or hold back every line that would add
+    /// memory until usage drops, disconnecting after all if it does not
+    /// within two seconds.
+    ShedPolicy memory_policy = ShedPolicy::EVICT;
+
+    /// Trace one message out of this many received by each client thread
+    /// (0 to disable tracing). SIGUSR1 writes the trace to trace_path.
+    std::uint32_t trace_sample = 0;
+
+    /// File the message trace is written to, as Chrome trace-event JSON.
+    std::string trace_path = "nohub-trace.json";
+
+    /// File every client connection, message and disconnection is recorded
+    /// to, for replay (empty to disable recording). SIGINT and SIGTERM then
+    /// stop the server cleanly, so that the recording is complete.
+    std::string record_path = std::string();
+
+    /// Configuration file the options were read from, reloaded whenever it
+    /// changes (empty to reload on SIGHUP only).
+    std::string config_path = std::string();
+
+    /// Read the options again, on SIGHUP or when config_path changes (empty
+    /// to disable live reloads). Throws if the new options are invalid, in
+    /// which case the running ones are kept. CPU placement, hot restart and
+    /// multicast egress settings only change on restart.
+    std::function<ServerOptions()> reload = nullptr;
+};
+
 class Server {
   public:
     /// \brief Constructor for Server class.
     ///
-    /// \param port Port number to bind the server socket.
+    /// \param port Port number to bind the server socket. Ignored when taking
+    /// over from a running server, whose listening socket is reused.
+    /// \param options Optional server features.
     /// \throws std::runtime_error if socket creation or binding fails.
-    explicit Server(std::uint16_t port);
+    explicit Server(std::uint16_t        port,
+                    const ServerOptions &options = ServerOptions());
     Server() = delete;
 
     /// \brief Destructor for Server class.
@@ -52,31 +196,357 @@ class Server {
     void stop() noexcept;
 
   private:
+    /// \brief Settings client threads read for every message, replaced as a
+    /// whole when the configuration is reloaded.
+    struct ClientSettings {
+        int          busy_poll_us;
+        SocketTuning socket_tuning;
+        std::size_t  bulk_threshold;
+        std::size_t  max_line;
+        ShedPolicy   memory_policy;
+    };
+
+    /// \brief Keeps the fan-outs of a channel in the order they were
+    /// started, as they run outside clients_mutex_.
+    struct FanOutOrder {
+        /// Number of fan-outs started. Guarded by clients_mutex_.
+        std::uint64_t started = 0;
+
+        /// Number of fan-outs that have queued their frame.
+        std::atomic<std::uint64_t> finished = 0;
+    };
+
     /// Accept loop to handle incoming client connections.
     ///
     /// \throws std::runtime_error if accepting a connection fails.
     void accept_loop();
 
+    /// Accept every pending connection, up to a batch limit, and admit or shed
+    /// each of them.
+    ///
+    /// \throws std::runtime_error if accepting a connection fails.
+    void accept_batch();
+
+    /// Check the admission limits for a new connection and consume an accept
+    /// token if it is admitted. Requires clients_mutex_ to be held.
+    ///
+    /// \param peer_ip IPv4 address of the client, in network byte order.
+    /// \return True if the connection is admitted.
+    bool admit(std::uint32_t peer_ip) noexcept;
+
+    /// Shed the next pending connection after accepting failed for lack of
+    /// descriptors, by briefly giving up reserve_fd_ to accept and reset it.
+    /// Otherwise, stop polling the listener for ACCEPT_BACKOFF_MS.
+    ///
+    /// \param error The errno accepting failed with.
+    /// \return True if a connection was shed.
+    bool shed_unaccepted(int error) noexcept;
+
+    /// Start a thread serving a connected client. Requires clients_mutex_ to
+    /// be held.
+    ///
+    /// \param client_sock_fd The socket file descriptor of the client.
+    /// \param peer_ip IPv4 address of the client, in network byte order.
+    /// \param buffered Data already received from the client.
+    /// \param outbound Data queued for the client by a previous process.
+    /// \return The new connection.
+    /// \throws std::runtime_error if the connection cannot be set up.
+    std::shared_ptr<Connection>
+    add_client(int           client_sock_fd,
+               std::uint32_t peer_ip,
+               std::string   buffered = std::string(),
+               std::string   outbound = std::string());
+
     /// Client handling loop.
     ///
-    /// \param client_sock_fd The socket file descriptor of the connected
-    /// client.
-    void client_loop(int client_sock_fd) noexcept;
+    /// \param connection The connected client.
+    /// \param peer_ip IPv4 address of the client, in network byte order.
+    /// \param buffered Data already received from the client.
+    void client_loop(std::shared_ptr<Connection> connection,
+                     std::uint32_t               peer_ip,
+                     std::string                 buffered) noexcept;
+
+    /// Handle a line received from a client: answer pings, manage channel
+    /// subscriptions, publish to channels, and broadcast anything else on the
+    /// lane matching its message class.
+    ///
+    /// \param connection The client the line was received from.
+    /// \param line The line, including its newline.
+    /// \param settings Settings of the calling client thread.
+    void dispatch(const std::shared_ptr<Connection> &connection,
+                  const std::string                 &line,
+                  const ClientSettings              &settings) noexcept;
+
+    /// Subscribe a client to a channel and send it the channel's current
+    /// values. Requires clients_mutex_ to be held.
+    ///
+    /// \param connection The client.
+    /// \param name Name of the channel.
+    /// \param bulk_threshold Size from which values go on the bulk lane.
+    void subscribe(const std::shared_ptr<Connection> &connection,
+                   const std::string                 &name,
+                   std::size_t                        bulk_threshold);
+
+    /// Unsubscribe a client from a channel. Requires clients_mutex_ to be
+    /// held.
+    ///
+    /// \param connection The client.
+    /// \param name Name of the channel.
+    void unsubscribe(const std::shared_ptr<Connection> &connection,
+                     const std::string                 &name);
+
+    /// Unsubscribe a client from every channel. Requires clients_mutex_ to
+    /// be held.
+    ///
+    /// \param connection The client.
+    /// \return Names of the channels the client was subscribed to.
+    std::vector<std::string>
+    unsubscribe_all(const std::shared_ptr<Connection> &connection);
+
+    /// Publish a "/pub <channel> <key> <value>" line to the channel's
+    /// subscribers other than the sender, updating the channel's last values
+    /// if it is conflated. On a reliable channel, the line is sent as
+    /// "/seq <channel> <sequence> <line>" and kept until acknowledged.
+    ///
+    /// \param connection The client the line was received from.
+    /// \param line The line, including its newline.
+    /// \param bulk_threshold Size from which the line goes on the bulk lane.
+    void publish(const Connection  &connection,
+                 const std::string &line,
+                 std::size_t        bulk_threshold);
+
+    /// Watch the configuration file for changes with inotify_fd_.
+    ///
+    /// \throws std::runtime_error if the watch cannot be set up.
+    void watch_config();
+
+    /// Handle a "/ack <channel> <sequence>" or "/resend <channel> <sequence>"
+    /// line: forget the messages of a reliable channel the client has
+    /// received, up to and including the sequence number, or send them
+    /// again from that sequence number on. Requires clients_mutex_ to be
+    /// held.
+    ///
+    /// \param connection The client the line was received from.
+    /// \param command "/ack" or "/resend".
+    /// \param name Name of the channel.
+    /// \param sequence The sequence number.
+    void acknowledge(const std::shared_ptr<Connection> &connection,
+                     std::string_view                   command,
+                     const std::string                 &name,
+                     std::uint64_t                      sequence);
+
+    /// Send unacknowledged messages of reliable channels again, starting
+    /// from the oldest, to every subscriber that has drained its queue
+    /// without acknowledging it within the timeout. The timeout doubles
+    /// with every retry of the same message.
+    void retransmit() noexcept;
+
+    /// Handle the signals queued on signal_fd_: write the message trace
+    /// after a SIGUSR1, reload the configuration after a SIGHUP, and stop
+    /// after a SIGINT or SIGTERM.
+    void handle_signals() noexcept;
+
+    /// Reload the configuration if the file watched by inotify_fd_ changed.
+    void handle_config_change() noexcept;
+
+    /// Bring memory usage back under the budget once it went over: with the
+    /// evict policy, shed the clients holding the most memory until enough
+    /// would be freed.
+    void shed_memory() noexcept;
+
+    /// Write the message trace.
+    void dump_trace() noexcept;
+
+    /// Read the options again and apply them to the running server. Client
+    /// threads pick up their new settings before handling their next
+    /// message; new clients get the new socket options and lanes.
+    void reload_config() noexcept;
+
+    /// Pin the calling thread to the next CPU of the configured set.
+    void pin_thread() noexcept;
+
+    /// Hand the listening socket and all clients over to a successor process
+    /// and stop serving. If the state cannot be sent, the clients are taken
+    /// back and serving goes on.
+    ///
+    /// \param peer_fd Handoff connection to the successor.
+    /// \return True if the successor took over.
+    bool hand_off(int peer_fd) noexcept;
+
+    /// Start serving connections handed over by a previous process, or
+    /// parked for a handoff that failed. Channel numbering resumes from the
+    /// given sequences.
+    ///
+    /// \param connections Connections to serve, emptied on return.
+    /// \param sequences Last sequence number of each channel.
+    void adopt_clients(
+        std::vector<HandoffConnection>                          &connections,
+        const std::vector<std::pair<std::string, std::uint64_t>> &sequences);
 
     /// Broadcast a message to all connected clients.
     ///
     /// \param message The message to broadcast.
     /// \param exclude_sock_fd The socket file descriptor to exclude from
     /// broadcasting (default is -1, meaning no exclusion).
+    /// \param lane Priority class of the message.
     void broadcast(const std::string_view message,
-                   int                    exclude_sock_fd = -1) noexcept;
-
-    Socket                               server_socket_;
-    std::uint16_t                        port_;
-    std::atomic<bool>                    is_running_;
-    std::mutex                           clients_mutex_;
-    std::vector<int>                     client_sock_fds_;
-    std::unordered_map<int, std::thread> client_threads_;
+                   int                    exclude_sock_fd = -1,
+                   Lane                   lane = Lane::NORMAL) noexcept;
+
+    /// Queue a frame for a set of clients, on the worker pool if there is
+    /// one. The recipients are copied under clients_mutex_, which is then
+    /// released before any frame is queued.
+    ///
+    /// \param lock Lock holding clients_mutex_; unlocked on return.
+    /// \param recipients The clients.
+    /// \param frame The frame to send.
+    /// \param exclude_sock_fd The socket file descriptor to skip.
+    /// \param lane Priority class of the frame.
+    /// \param key Conflation key viewing the frame's data, or empty.
+    /// \param order Order the frame must keep with others sent to the same
+    /// clients, or nullptr if frames from different senders may overtake
+    /// each other.
+    void
+    fan_out(std::unique_lock<std::mutex>                   &lock,
+            const std::vector<std::shared_ptr<Connection>> &recipients,
+            const Frame                                    &frame,
+            int                                             exclude_sock_fd,
+            Lane                                            lane,
+            std::string_view                                key,
+            const std::shared_ptr<FanOutOrder>             &order) noexcept;
+
+    /// Wait until no fan-out is queueing frames. Called with clients_mutex_
+    /// held, which keeps new fan-outs from starting.
+    void wait_for_fan_outs() noexcept;
+
+    /// \brief Message of a reliable channel a subscriber has not
+    /// acknowledged yet.
+    struct Unacked {
+        std::uint64_t                         sequence;
+        Frame                                 frame;
+        std::chrono::steady_clock::time_point sent_time;
+        MemoryCharge                          charge;
+        unsigned                              retries = 0;
+    };
+
+    /// \brief Value last published for a key of a conflated channel.
+    struct LastValue {
+        Frame        frame;
+        MemoryCharge charge;
+    };
+
+    /// \brief Unacknowledged messages of one subscriber, oldest first.
+    using Window = std::deque<Unacked>;
+
+    /// \brief Subscribers and cached values of a channel.
+    struct Channel {
+        /// Conflated, multicast and reliable channels outlive their
+        /// subscribers, to keep their values and sequence numbers.
+        bool is_persistent() const noexcept {
+            return this->conflate || this->multicast || this->reliable;
+        }
+
+        bool                                           conflate  = false;
+        bool                                           multicast = false;
+        bool                                           reliable  = false;
+        std::uint64_t                                  sequence  = 0;
+        std::vector<std::shared_ptr<Connection>>       subscribers;
+        std::unordered_map<std::string, LastValue>     last_values;
+        std::unordered_map<const Connection *, Window> windows;
+        std::shared_ptr<FanOutOrder>                   order =
+            std::make_shared<FanOutOrder>();
+    };
+
+    /// Look a channel up by name. Requires clients_mutex_ to be held.
+    ///
+    /// \param name Name of the channel.
+    /// \param create True to create the channel if it does not exist yet;
+    /// conflated and multicast channels are always created.
+    /// \return The channel, or nullptr if it does not exist.
+    Channel *find_channel(const std::string &name, bool create);
+
+    /// Largest number of connections accepted per readiness event.
+    static constexpr std::size_t ACCEPT_BATCH_SIZE = 256;
+
+    /// Time the listener is left alone after accepting failed for lack of
+    /// memory, or of descriptors with none in reserve.
+    static constexpr int ACCEPT_BACKOFF_MS = 100;
+
+    /// Capacity above which a client thread frees its line buffer after
+    /// handling a long line.
+    static constexpr std::size_t LINE_SHRINK_SIZE = 64 * 1024;
+
+    /// Interval at which a client thread holding back a line because of the
+    /// memory budget checks whether usage dropped.
+    static constexpr int PAUSE_POLL_MS = 10;
+
+    /// Bytes a client holding back a line may have buffered behind it
+    /// before it is no longer read from.
+    static constexpr std::size_t PAUSE_READ_SIZE = 64 * 1024;
+
+    /// Longest time the pause policy may leave usage over the budget before
+    /// the clients holding the most memory are evicted.
+    static constexpr int PAUSE_EVICT_MS = 2000;
+
+    /// Interval at which the accept loop checks usage while it is over the
+    /// budget under the pause policy.
+    static constexpr int PAUSE_CHECK_MS = 100;
+
+    /// Largest number of messages sent again to a subscriber per timeout.
+    static constexpr std::size_t RETRANSMIT_BURST = 64;
+
+    /// Largest number of times the retransmit timeout is doubled.
+    static constexpr unsigned RETRANSMIT_MAX_BACKOFF = 6;
+
+    Socket                                             server_socket_;
+    Socket                                             handoff_socket_;
+    std::uint16_t                                      port_;
+    int                                                wake_fd_;
+    int                                                signal_fd_;
+    int                                                inotify_fd_;
+    int                                                timer_fd_;
+    int                                                reserve_fd_;
+    std::atomic<bool>                                  is_running_;
+    std::atomic<bool>                                  is_handing_off_;
+    std::atomic<std::size_t>                           fan_outs_;
+    std::mutex                                         clients_mutex_;
+    std::vector<std::shared_ptr<Connection>>           connections_;
+    std::unordered_map<int, std::thread>               client_threads_;
+    std::unordered_map<std::uint32_t, std::size_t>     ip_connections_;
+    std::vector<HandoffConnection>                     taken_over_;
+    std::vector<std::pair<std::string, std::uint64_t>> taken_over_sequences_;
+    std::vector<HandoffConnection>                     handed_off_;
+    std::vector<std::shared_ptr<Connection>>           retired_;
+    std::vector<int>                                   cpus_;
+    std::atomic<std::size_t>                           next_cpu_;
+    ServerOptions                                      options_;
+    LiveValue<ClientSettings>                          client_settings_;
+    std::shared_ptr<MemoryBudget>                      memory_budget_;
+    MemoryAccount                                      channel_memory_;
+    std::size_t                                        connection_memory_;
+    std::chrono::steady_clock::time_point              memory_report_time_;
+    std::chrono::steady_clock::time_point              memory_pause_time_;
+    std::size_t                                        max_connections_;
+    std::size_t                                        max_connections_per_ip_;
+    double                                             accept_rate_;
+    double                                             accept_tokens_;
+    std::chrono::steady_clock::time_point              accept_refill_time_;
+    std::chrono::steady_clock::time_point              accept_resume_time_;
+    std::size_t                                        shed_count_;
+    std::chrono::steady_clock::time_point              shed_report_time_;
+    std::size_t                                        fanout_chunk_;
+    LaneWeights                                        lane_weights_;
+    std::size_t                                        zerocopy_threshold_;
+    std::unordered_set<std::string>                    conflate_channels_;
+    std::unordered_set<std::string>                    multicast_channels_;
+    std::unordered_set<std::string>                    reliable_channels_;
+    std::size_t                                        reliable_window_;
+    std::chrono::milliseconds                          reliable_timeout_;
+    std::unique_ptr<MulticastSender>                   multicast_;
+    std::unique_ptr<SessionRecorder>                   recorder_;
+    std::unordered_map<std::string, Channel>           channels_;
+    std::string                                        config_name_;
+    std::shared_ptr<Scheduler>                         scheduler_;
 };
 
 } // namespace core
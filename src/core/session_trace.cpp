@@ -0,0 +1,234 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file session_trace.cpp
+/// Recording of client sessions for replay.
+///
+//===----------------------------------------------------------------------===//
+
+#include "session_trace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace core {
+
+namespace {
+
+/// \brief First bytes of every session recording, ending with the format
+/// version.
+constexpr std::string_view SESSION_MAGIC = "NHSESS01";
+
+/// \brief Get the current monotonic time.
+///
+/// \return Time in microseconds.
+std::uint64_t now_us() noexcept {
+    struct timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000ULL +
+           static_cast<std::uint64_t>(ts.tv_nsec) / 1000ULL;
+}
+
+/// \brief Append a number as a LEB128 varint.
+///
+/// \param out Buffer to append to.
+/// \param value The number.
+void put_varint(std::string &out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(static_cast<char>(value));
+}
+
+/// \brief Read a LEB128 varint.
+///
+/// \param in Remaining input, advanced past the number.
+/// \param value Receives the number.
+/// \return False if the input ends before the number does.
+bool get_varint(std::string_view &in, std::uint64_t &value) noexcept {
+    unsigned    shift = 0;
+    std::size_t pos   = 0;
+    value             = 0;
+    while (pos < in.size() && shift < 64) {
+        auto byte = static_cast<unsigned char>(in[pos++]);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            in.remove_prefix(pos);
+            return true;
+        }
+
+        shift += 7;
+    }
+
+    return false;
+}
+
+} // namespace
+
+SessionRecorder::SessionRecorder(const std::string_view path)
+    : start_us_(now_us()), last_us_(0), next_client_(0) {
+    this->fd_ = ::open(std::string(path).c_str(),
+                       O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0644);
+    if (this->fd_ < 0) {
+        throw std::runtime_error(std::string("open: ") + std::strerror(errno));
+    }
+
+    this->buffer_.reserve(FLUSH_BYTES * 2);
+    this->buffer_.append(SESSION_MAGIC);
+}
+
+SessionRecorder::~SessionRecorder() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    flush_locked();
+    if (this->fd_ >= 0) {
+        ::close(this->fd_);
+    }
+}
+
+std::uint32_t SessionRecorder::connect() noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    std::uint32_t               client = this->next_client_++;
+    append(SessionEventKind::CONNECT, client, std::string_view());
+    return client;
+}
+
+void SessionRecorder::message(std::uint32_t          client,
+                              const std::string_view line) noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    append(SessionEventKind::MESSAGE, client, line);
+}
+
+void SessionRecorder::disconnect(std::uint32_t client) noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    append(SessionEventKind::DISCONNECT, client, std::string_view());
+}
+
+void SessionRecorder::append(SessionEventKind       kind,
+                             std::uint32_t          client,
+                             const std::string_view line) noexcept {
+    if (this->fd_ < 0) {
+        return;
+    }
+
+    try {
+        // The clock is read under the lock, so that deltas never go back.
+        std::uint64_t time = now_us() - this->start_us_;
+        put_varint(this->buffer_, time - this->last_us_);
+        put_varint(this->buffer_,
+                   (static_cast<std::uint64_t>(client) << 2) |
+                       static_cast<std::uint64_t>(kind));
+        if (kind == SessionEventKind::MESSAGE) {
+            put_varint(this->buffer_, line.size());
+            this->buffer_.append(line);
+        }
+
+        this->last_us_ = time;
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "[-] record: %s\n", e.what());
+    }
+
+    if (this->buffer_.size() >= FLUSH_BYTES) {
+        flush_locked();
+    }
+}
+
+void SessionRecorder::flush_locked() noexcept {
+    std::size_t offset = 0;
+    while (this->fd_ >= 0 && offset < this->buffer_.size()) {
+        ssize_t bytes_written = ::write(this->fd_,
+                                        this->buffer_.data() + offset,
+                                        this->buffer_.size() - offset);
+        if (bytes_written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes_written < 0) {
+            std::fprintf(stderr,
+                         "[-] record: write: %s; recording stopped\n",
+                         std::strerror(errno));
+            ::close(this->fd_);
+            this->fd_ = -1;
+            break;
+        }
+
+        offset += static_cast<std::size_t>(bytes_written);
+    }
+
+    this->buffer_.clear();
+}
+
+std::vector<SessionEvent> load_session(const std::string_view path) {
+    std::FILE *file = std::fopen(std::string(path).c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error(std::string("fopen: ") + std::strerror(errno));
+    }
+
+    std::string contents;
+    char        chunk[65536];
+    std::size_t bytes_read;
+    while ((bytes_read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.append(chunk, bytes_read);
+    }
+
+    bool failed = std::ferror(file) != 0;
+    std::fclose(file);
+    if (failed) {
+        throw std::runtime_error("fread: cannot read " + std::string(path));
+    }
+
+    std::string_view in(contents);
+    if (!in.starts_with(SESSION_MAGIC)) {
+        throw std::runtime_error(std::string(path) +
+                                 " is not a session recording");
+    }
+
+    in.remove_prefix(SESSION_MAGIC.size());
+
+    std::vector<SessionEvent> events;
+    std::uint64_t             time = 0;
+    while (!in.empty()) {
+        std::uint64_t delta;
+        std::uint64_t tag;
+        if (!get_varint(in, delta) || !get_varint(in, tag)) {
+            break;
+        }
+
+        SessionEvent event;
+        time += delta;
+        event.time_us = time;
+        event.client  = static_cast<std::uint32_t>(tag >> 2);
+        event.kind    = static_cast<SessionEventKind>(tag & 0x3);
+        if (event.kind == SessionEventKind::MESSAGE) {
+            std::uint64_t size;
+            if (!get_varint(in, size) || size > in.size()) {
+                break;
+            }
+
+            event.line = std::string(in.substr(0, size));
+            in.remove_prefix(size);
+        } else if (event.kind != SessionEventKind::CONNECT &&
+                   event.kind != SessionEventKind::DISCONNECT) {
+            throw std::runtime_error(std::string(path) +
+                                     ": unknown event kind");
+        }
+
+        events.push_back(std::move(event));
+    }
+
+    return events;
+}
+
+} // namespace core
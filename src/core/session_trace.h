@@ -0,0 +1,119 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file session_trace.h
+/// Recording of client sessions for replay.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_SESSION_TRACE_H
+#define NOHUB_CORE_SESSION_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace core {
+
+/// \brief Kind of a recorded session event.
+enum class SessionEventKind : std::uint8_t {
+    CONNECT    = 0, ///< A client connected.
+    MESSAGE    = 1, ///< A client sent a line.
+    DISCONNECT = 2, ///< A client disconnected.
+};
+
+/// \brief Event of a recorded session.
+struct SessionEvent {
+    std::uint64_t    time_us; ///< Time since the recording started.
+    std::uint32_t    client;  ///< Client number, unique within the recording.
+    SessionEventKind kind;
+    std::string      line; ///< Line sent, including its newline.
+};
+
+/// \brief Records what clients do, with timings, into a compact binary file.
+///
+/// The file starts with an 8-byte magic string, followed by one record per
+/// event: the time elapsed since the previous event in microseconds, the
+/// client number shifted left by two bits and combined with the event kind,
+/// and for messages the line length and bytes. Numbers are stored as LEB128
+/// varints, so a short message costs only a few bytes over its length.
+///
+/// Events are buffered and written in large blocks; the buffer is written
+/// out when the recorder is destroyed.
+class SessionRecorder {
+  public:
+    /// \brief Constructor for SessionRecorder class.
+    ///
+    /// \param path Output file path, truncated if it exists.
+    /// \throws std::runtime_error if the file cannot be created.
+    explicit SessionRecorder(const std::string_view path);
+    SessionRecorder() = delete;
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    SessionRecorder(const SessionRecorder &)            = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    /// \brief Destructor for SessionRecorder class.
+    ///
+    /// Writes the buffered events and closes the file.
+    ~SessionRecorder();
+
+    /// \brief Record a client connecting.
+    ///
+    /// \return Number of the client, to record its other events with.
+    std::uint32_t connect() noexcept;
+
+    /// \brief Record a line sent by a client.
+    ///
+    /// \param client Number of the client.
+    /// \param line The line, including its newline.
+    void message(std::uint32_t client, const std::string_view line) noexcept;
+
+    /// \brief Record a client disconnecting.
+    ///
+    /// \param client Number of the client.
+    void disconnect(std::uint32_t client) noexcept;
+
+  private:
+    /// Buffered bytes from which events are written to the file.
+    static constexpr std::size_t FLUSH_BYTES = 64 * 1024;
+
+    /// Append an event to the buffer, writing the buffer out once it is
+    /// full. Requires mutex_ to be held.
+    void append(SessionEventKind       kind,
+                std::uint32_t          client,
+                const std::string_view line) noexcept;
+
+    /// Write the buffer to the file. On failure, recording stops. Requires
+    /// mutex_ to be held.
+    void flush_locked() noexcept;
+
+    int           fd_;
+    std::mutex    mutex_;
+    std::string   buffer_;
+    std::uint64_t start_us_;
+    std::uint64_t last_us_;
+    std::uint32_t next_client_;
+};
+
+/// \brief Read a session recorded by SessionRecorder.
+///
+/// A record cut short at the end of the file, as left by a server that was
+/// killed, is ignored.
+///
+/// \param path Path of the recording.
+/// \return The events, in the order they were recorded.
+/// \throws std::runtime_error if the file cannot be read or is not a
+/// session recording.
+std::vector<SessionEvent> load_session(const std::string_view path);
+
+} // namespace core
+
+#endif // NOHUB_CORE_SESSION_TRACE_H
@@ -15,11 +15,64 @@
 #include <arpa/inet.h>
 #include <cstring>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdexcept>
 #include <unistd.h>
 
 namespace core {
 
+namespace {
+
+void set_int_option(int sock_fd, int level, int name, int value) {
+    if (::setsockopt(sock_fd, level, name, &value, sizeof(value)) < 0) {
+        throw std::runtime_error(std::string("setsockopt: ") +
+                                 std::strerror(errno));
+    }
+}
+
+int get_int_option(int sock_fd, int level, int name) noexcept {
+    int       value = 0;
+    socklen_t len   = sizeof(value);
+    ::getsockopt(sock_fd, level, name, &value, &len);
+    return value;
+}
+
+} // namespace
+
+SocketTuning SocketTuning::profile(const std::string_view name) {
+    SocketTuning tuning;
+    if (name == "default") {
+        return tuning;
+    }
+
+    if (name == "latency") {
+        // Small writes leave at once, and little unsent data is queued in the
+        // kernel so that new messages are not stuck behind stale ones.
+        tuning.nodelay            = true;
+        tuning.notsent_lowat      = 16 * 1024;
+        tuning.keepalive          = true;
+        tuning.keepalive_idle     = 30;
+        tuning.keepalive_interval = 5;
+        tuning.keepalive_count    = 3;
+        return tuning;
+    }
+
+    if (name == "throughput") {
+        // Large buffers keep the pipe full on high bandwidth-delay paths,
+        // and Nagle coalesces small messages into full segments.
+        tuning.send_buffer        = 4 * 1024 * 1024;
+        tuning.recv_buffer        = 4 * 1024 * 1024;
+        tuning.keepalive          = true;
+        tuning.keepalive_idle     = 60;
+        tuning.keepalive_interval = 10;
+        tuning.keepalive_count    = 6;
+        return tuning;
+    }
+
+    throw std::invalid_argument("unknown socket profile: " + std::string(name));
+}
+
 Socket::Socket(int sock_fd) noexcept : sock_fd_(sock_fd) {}
 
 Socket::Socket(const std::string_view ip, std::uint16_t port) {
@@ -43,8 +96,12 @@ Socket::Socket(const struct sockaddr_in &addr) {
 }
 
 Socket::Socket(Socket &&other) noexcept {
-    this->sock_fd_ = other.sock_fd_;
-    other.sock_fd_ = -1;
+    this->addr_     = other.addr_;
+    this->sock_fd_  = other.sock_fd_;
+    this->recv_buf_ = std::move(other.recv_buf_);
+    this->recv_pos_ = other.recv_pos_;
+    other.sock_fd_  = -1;
+    other.recv_pos_ = 0;
 }
 
 Socket &Socket::operator=(Socket &&other) noexcept {
@@ -53,8 +110,12 @@ Socket &Socket::operator=(Socket &&other) noexcept {
             ::close(this->sock_fd_);
         }
 
-        this->sock_fd_ = other.sock_fd_;
-        other.sock_fd_ = -1;
+        this->addr_     = other.addr_;
+        this->sock_fd_  = other.sock_fd_;
+        this->recv_buf_ = std::move(other.recv_buf_);
+        this->recv_pos_ = other.recv_pos_;
+        other.sock_fd_  = -1;
+        other.recv_pos_ = 0;
     }
 
     return *this;
@@ -101,6 +162,66 @@ int Socket::accept() {
     return client_fd;
 }
 
+int Socket::try_accept(struct sockaddr_in &peer_addr) {
+    while (true) {
+        socklen_t addr_len  = sizeof(peer_addr);
+        int       client_fd = ::accept4(
+            this->sock_fd_,
+            reinterpret_cast<struct sockaddr *>(&peer_addr),
+            &addr_len,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd >= 0) {
+            return client_fd;
+        }
+
+        switch (errno) {
+            case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+                return -1;
+            case EMFILE:
+            case ENFILE:
+            case ENOBUFS:
+            case ENOMEM:
+                return -1; // Transient, the caller decides how to back off
+            case EINTR:
+            case ECONNABORTED:
+            case EPROTO:
+                continue; // Retry, the connection went away before accept
+            default:
+                throw std::runtime_error(std::string("accept4: ") +
+                                         std::strerror(errno));
+        }
+    }
+}
+
+void Socket::set_nonblocking() {
+    int flags = ::fcntl(this->sock_fd_, F_GETFL);
+    if (flags < 0 || ::fcntl(this->sock_fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error(std::string("fcntl O_NONBLOCK: ") +
+                                 std::strerror(errno));
+    }
+}
+
+bool Socket::would_block(int error) noexcept {
+    switch (error) {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Socket::abort(int sock_fd) noexcept {
+    struct linger linger{1, 0};
+    ::setsockopt(sock_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    ::close(sock_fd);
+}
+
 void Socket::connect_to(const struct sockaddr_in &addr) {
     if (::connect(this->sock_fd_,
                   reinterpret_cast<const struct sockaddr *>(&addr),
@@ -119,24 +240,107 @@ void Socket::bind_to(const sockaddr_in &addr) {
     }
 }
 
+void Socket::set_busy_poll(int usec) {
+    if (::setsockopt(
+            this->sock_fd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) <
+        0) {
+        throw std::runtime_error(std::string("setsockopt SO_BUSY_POLL: ") +
+                                 std::strerror(errno));
+    }
+}
+
+void Socket::tune(const SocketTuning &tuning) { tune(this->sock_fd_, tuning); }
+
+void Socket::tune(int sock_fd, const SocketTuning &tuning) {
+    if (tuning.nodelay) {
+        set_int_option(sock_fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+
+    if (tuning.send_buffer > 0) {
+        set_int_option(sock_fd, SOL_SOCKET, SO_SNDBUF, tuning.send_buffer);
+    }
+
+    if (tuning.recv_buffer > 0) {
+        set_int_option(sock_fd, SOL_SOCKET, SO_RCVBUF, tuning.recv_buffer);
+    }
+
+    if (tuning.notsent_lowat > 0) {
+        set_int_option(
+            sock_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, tuning.notsent_lowat);
+    }
+
+    if (tuning.keepalive) {
+        set_int_option(sock_fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+        if (tuning.keepalive_idle > 0) {
+            set_int_option(
+                sock_fd, IPPROTO_TCP, TCP_KEEPIDLE, tuning.keepalive_idle);
+        }
+
+        if (tuning.keepalive_interval > 0) {
+            set_int_option(
+                sock_fd, IPPROTO_TCP, TCP_KEEPINTVL, tuning.keepalive_interval);
+        }
+
+        if (tuning.keepalive_count > 0) {
+            set_int_option(
+                sock_fd, IPPROTO_TCP, TCP_KEEPCNT, tuning.keepalive_count);
+        }
+    }
+}
+
+SocketTuning Socket::tuning() const noexcept {
+    SocketTuning tuning;
+    tuning.nodelay =
+        get_int_option(this->sock_fd_, IPPROTO_TCP, TCP_NODELAY) != 0;
+    tuning.send_buffer = get_int_option(this->sock_fd_, SOL_SOCKET, SO_SNDBUF);
+    tuning.recv_buffer = get_int_option(this->sock_fd_, SOL_SOCKET, SO_RCVBUF);
+    tuning.notsent_lowat =
+        get_int_option(this->sock_fd_, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+    tuning.keepalive =
+        get_int_option(this->sock_fd_, SOL_SOCKET, SO_KEEPALIVE) != 0;
+    tuning.keepalive_idle =
+        get_int_option(this->sock_fd_, IPPROTO_TCP, TCP_KEEPIDLE);
+    tuning.keepalive_interval =
+        get_int_option(this->sock_fd_, IPPROTO_TCP, TCP_KEEPINTVL);
+    tuning.keepalive_count =
+        get_int_option(this->sock_fd_, IPPROTO_TCP, TCP_KEEPCNT);
+    return tuning;
+}
+
+bool Socket::tcp_info(int sock_fd, struct tcp_info &info) noexcept {
+    socklen_t len = sizeof(info);
+    return ::getsockopt(sock_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0;
+}
+
 ssize_t Socket::send_all(const std::string_view data) {
+    return send_all(this->sock_fd_, data);
+}
+
+ssize_t Socket::send_all(int sock_fd, const std::string_view data) {
     ssize_t     total_sent = 0;
     const char *buf        = data.data();
     std::size_t left       = data.size();
 
     while (left > 0) {
-        ssize_t bytes_sent = ::send(this->sock_fd_, buf + total_sent, left, 0);
+        ssize_t bytes_sent =
+            ::send(sock_fd, buf + total_sent, left, MSG_NOSIGNAL);
         if (bytes_sent <= 0) {
             if (errno == EINTR) {
                 continue; // Retry on interrupt
             }
 
+            if (would_block(errno)) {
+                struct pollfd pfd{sock_fd, POLLOUT, 0};
+                ::poll(&pfd, 1, -1);
+                continue; // Retry once writable
+            }
+
             throw std::runtime_error(std::string("send: ") +
                                      std::strerror(errno));
         }
 
         total_sent += bytes_sent;
-        left -= bytes_sent;
+        left -= static_cast<std::size_t>(bytes_sent);
     }
 
     return total_sent;
@@ -144,21 +348,81 @@ ssize_t Socket::send_all(const std::string_view data) {
 
 std::string Socket::recv_line() {
     std::string output;
-    char        ch;
 
-    while (true) {
-        ssize_t bytes_received = ::recv(this->sock_fd_, &ch, 1, 0);
-        if (bytes_received < 0) {
-            return std::string(); // Error occurred
+    while (!pop_line(output)) {
+        if (recv_some() <= 0) {
+            return std::string(); // Error occurred or peer closed
         }
+    }
 
-        output.push_back(ch);
-        if (ch == '\n') {
-            break; // End of line
+    return output;
+}
+
+ssize_t Socket::recv_some() {
+    // Compact once the consumed prefix dominates, so the buffer does not
+    // grow with the total amount of data ever received.
+    if (this->recv_pos_ > 0 &&
+        this->recv_pos_ >= this->recv_buf_.size() - this->recv_pos_) {
+        this->recv_buf_.erase(0, this->recv_pos_);
+        this->recv_pos_ = 0;
+    }
+
+    ssize_t     bytes_received = 0;
+    std::size_t used           = this->recv_buf_.size();
+    this->recv_buf_.resize_and_overwrite(
+        used + RECV_BLOCK_SIZE, [&](char *buf, std::size_t) {
+            do {
+                bytes_received =
+                    ::recv(this->sock_fd_, buf + used, RECV_BLOCK_SIZE, 0);
+            } while (bytes_received < 0 && errno == EINTR);
+
+            return used + static_cast<std::size_t>(
+                              bytes_received > 0 ? bytes_received : 0);
+        });
+
+    return bytes_received;
+}
+
+bool Socket::pop_line(std::string &line) {
+    const char *begin = this->recv_buf_.data() + this->recv_pos_;
+    std::size_t left  = this->recv_buf_.size() - this->recv_pos_;
+    const void *nl    = std::memchr(begin, '\n', left);
+    if (nl == nullptr) {
+        return false;
+    }
+
+    auto len = static_cast<std::size_t>(static_cast<const char *>(nl) - begin);
+    len += 1; // Keep the newline, as callers forward lines verbatim
+    line.assign(begin, len);
+    this->recv_pos_ += len;
+    if (this->recv_pos_ == this->recv_buf_.size()) {
+        this->recv_buf_.clear();
+        this->recv_pos_ = 0;
+        if (this->recv_buf_.capacity() > RECV_SHRINK_SIZE) {
+            this->recv_buf_.shrink_to_fit();
         }
     }
 
-    return output;
+    return true;
+}
+
+std::string_view Socket::buffered() const noexcept {
+    return std::string_view(this->recv_buf_).substr(this->recv_pos_);
+}
+
+std::size_t Socket::buffer_capacity() const noexcept {
+    return this->recv_buf_.capacity();
+}
+
+void Socket::preload(const std::string_view data) {
+    this->recv_buf_.replace(0, this->recv_pos_, data);
+    this->recv_pos_ = 0;
+}
+
+int Socket::release() noexcept {
+    int sock_fd    = this->sock_fd_;
+    this->sock_fd_ = -1;
+    return sock_fd;
 }
 
 sockaddr_in Socket::make_addr(const std::string_view ip,
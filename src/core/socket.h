@@ -15,6 +15,7 @@
 
 #include <cstdint>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
 #include <string_view>
 #include <sys/socket.h>
@@ -22,6 +23,46 @@
 
 namespace core {
 
+/// \brief TCP socket options tuned together for a workload.
+///
+/// A value of zero leaves the corresponding kernel default in place.
+struct SocketTuning {
+    /// Disable Nagle's algorithm (TCP_NODELAY).
+    bool nodelay = false;
+
+    /// Kernel send buffer size in bytes (SO_SNDBUF).
+    int send_buffer = 0;
+
+    /// Kernel receive buffer size in bytes (SO_RCVBUF).
+    int recv_buffer = 0;
+
+    /// Unsent bytes above which the socket stops being writable
+    /// (TCP_NOTSENT_LOWAT).
+    int notsent_lowat = 0;
+
+    /// Enable TCP keepalive probes (SO_KEEPALIVE).
+    bool keepalive = false;
+
+    /// Idle seconds before the first keepalive probe (TCP_KEEPIDLE).
+    int keepalive_idle = 0;
+
+    /// Seconds between keepalive probes (TCP_KEEPINTVL).
+    int keepalive_interval = 0;
+
+    /// Unanswered probes before the connection is dropped (TCP_KEEPCNT).
+    int keepalive_count = 0;
+
+    /// \brief Get a named tuning profile.
+    ///
+    /// "default" keeps the kernel defaults, "latency" favours small messages
+    /// leaving immediately and "throughput" favours large transfers.
+    ///
+    /// \param name Name of the profile.
+    /// \return The tuning profile.
+    /// \throws std::invalid_argument if the profile does not exist.
+    static SocketTuning profile(const std::string_view name);
+};
+
 class Socket {
   public:
     /// \brief Constructor for Socket class.
@@ -88,6 +129,37 @@ class Socket {
     /// \throws std::runtime_error if accept fails.
     int accept();
 
+    /// \brief Accept a pending connection without blocking.
+    ///
+    /// The listening socket must be non-blocking. The accepted socket is
+    /// created with SOCK_NONBLOCK and SOCK_CLOEXEC.
+    ///
+    /// \param peer_addr Structure receiving the address of the peer.
+    /// \return Socket file descriptor, or -1 if no connection is pending or
+    /// the process ran out of descriptors or memory, with errno telling
+    /// which.
+    /// \throws std::runtime_error if accept fails for any other reason.
+    int try_accept(struct sockaddr_in &peer_addr);
+
+    /// \brief Put the socket in non-blocking mode.
+    ///
+    /// \throws std::runtime_error if fcntl fails.
+    void set_nonblocking();
+
+    /// \brief Abort the connection with a reset and close the socket.
+    ///
+    /// Avoids the FIN handshake and TIME_WAIT state of a regular close.
+    ///
+    /// \param sock_fd Socket file descriptor to abort.
+    static void abort(int sock_fd) noexcept;
+
+    /// \brief Check whether an error only means a non-blocking call would
+    /// have blocked.
+    ///
+    /// \param error The errno value.
+    /// \return True for EAGAIN and EWOULDBLOCK.
+    static bool would_block(int error) noexcept;
+
     /// \brief Connect to a remote address.
     ///
     /// \param addr sockaddr_in structure representing the remote address.
@@ -100,24 +172,120 @@ class Socket {
     /// \throws std::runtime_error if bind fails.
     void bind_to(const struct sockaddr_in &addr);
 
+    /// \brief Set the busy polling time for blocking reads (SO_BUSY_POLL).
+    ///
+    /// Sockets accepted from a listening socket inherit the setting.
+    ///
+    /// \param usec Time to busy poll the device queue, in microseconds.
+    /// \throws std::runtime_error if setsockopt fails.
+    void set_busy_poll(int usec);
+
+    /// \brief Apply a tuning profile to the socket.
+    ///
+    /// Buffer sizes only fully apply to connections if set on the listening
+    /// socket before listen().
+    ///
+    /// \param tuning Socket options to apply.
+    /// \throws std::runtime_error if setsockopt fails.
+    void tune(const SocketTuning &tuning);
+
+    /// \brief Apply a tuning profile to a socket file descriptor.
+    ///
+    /// \param sock_fd Socket file descriptor.
+    /// \param tuning Socket options to apply.
+    /// \throws std::runtime_error if setsockopt fails.
+    static void tune(int sock_fd, const SocketTuning &tuning);
+
+    /// \brief Read back the tuning options in effect on the socket.
+    ///
+    /// Buffer sizes are reported as adjusted by the kernel.
+    ///
+    /// \return The effective socket options.
+    SocketTuning tuning() const noexcept;
+
+    /// \brief Get TCP statistics of a connected socket (TCP_INFO).
+    ///
+    /// \param sock_fd Socket file descriptor.
+    /// \param info Structure receiving the statistics.
+    /// \return True on success.
+    static bool tcp_info(int sock_fd, struct tcp_info &info) noexcept;
+
     /// \brief Send all data over the socket.
     ///
     /// \param data Data to send as a string view.
     /// \return Number of bytes sent.
+    /// \throws std::runtime_error if send fails.
     ssize_t send_all(const std::string_view data);
 
+    /// \brief Send all data over a socket file descriptor.
+    ///
+    /// Waits for the socket to become writable if it is non-blocking.
+    ///
+    /// \param sock_fd Socket file descriptor.
+    /// \param data Data to send as a string view.
+    /// \return Number of bytes sent.
+    /// \throws std::runtime_error if send fails.
+    static ssize_t send_all(int sock_fd, const std::string_view data);
+
     /// \brief Receive a line of data from the socket.
     ///
+    /// Data is read from the kernel in blocks and kept in an internal buffer,
+    /// so bytes following the returned line are served by later calls.
+    ///
     /// \return Received line as a string or an empty string on error.
     std::string recv_line();
 
+    /// \brief Perform a single read from the socket into the read buffer.
+    ///
+    /// \return Number of bytes read, 0 on end of stream or -1 on error.
+    ssize_t recv_some();
+
+    /// \brief Get the bytes received but not yet returned as lines.
+    ///
+    /// \return View of the unconsumed part of the read buffer.
+    std::string_view buffered() const noexcept;
+
+    /// \brief Get the memory allocated for the read buffer.
+    ///
+    /// \return Capacity of the read buffer in bytes.
+    std::size_t buffer_capacity() const noexcept;
+
+    /// \brief Prepend data to the read buffer, as if it had been received.
+    ///
+    /// \param data Data to insert before any buffered bytes.
+    void preload(const std::string_view data);
+
+    /// \brief Give up ownership of the socket file descriptor.
+    ///
+    /// \return Socket file descriptor, which the caller must close.
+    int release() noexcept;
+
+    /// \brief Extract a complete line from the read buffer.
+    ///
+    /// \param line String receiving the line, including its trailing newline.
+    /// \return True if a complete line was available.
+    bool pop_line(std::string &line);
+
   private:
+    /// \brief Size of a single read from the kernel.
+    static constexpr std::size_t RECV_BLOCK_SIZE = 16 * 1024;
+
+    /// \brief Capacity above which an emptied read buffer is freed, so that
+    /// one long line does not pin its memory for the socket's lifetime.
+    static constexpr std::size_t RECV_SHRINK_SIZE = 4 * RECV_BLOCK_SIZE;
+
     /// \brief Socket address structure.
     struct sockaddr_in addr_;
 
     /// \brief Socket file descriptor.
     int sock_fd_;
 
+    /// \brief Bytes received but not yet returned as lines.
+    std::string recv_buf_;
+
+    /// \brief Offset of the first unconsumed byte in recv_buf_.
+    std::size_t recv_pos_ = 0;
+
     /// \brief Create a sockaddr_in structure from an IP address and port.
     ///
     /// \param ip IP address as a string view.
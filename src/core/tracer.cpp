@@ -0,0 +1,282 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file tracer.cpp
+/// Sampling message tracer for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace core {
+
+namespace {
+
+/// \brief Records kept per thread; older ones are overwritten.
+constexpr std::size_t TRACE_BUFFER_SIZE = 1024;
+
+/// \brief Slot of a trace buffer.
+///
+/// Fields are relaxed atomics so that dump() may read a slot while its
+/// owner overwrites it; such torn slots are detected and discarded.
+struct TraceSlot {
+    std::atomic<std::uint64_t> id;
+    std::atomic<std::uint64_t> time;
+    std::atomic<std::int32_t>  sock_fd;
+    std::atomic<TraceStage>    stage;
+};
+
+/// \brief Ring of records written by a single thread.
+struct TraceBuffer {
+    explicit TraceBuffer(std::uint32_t index) : tid(index), head(0) {}
+
+    std::uint32_t                              tid;
+    std::atomic<std::uint64_t>                 head;
+    std::array<TraceSlot, TRACE_BUFFER_SIZE> slots;
+};
+
+/// \brief A record copied out of a trace buffer.
+struct TraceRecord {
+    std::uint64_t time;
+    std::int32_t  sock_fd;
+    TraceStage    stage;
+    std::uint32_t tid;
+};
+
+/// \brief Every trace buffer ever created, and those of exited threads.
+///
+/// Buffers are never freed, so that dump() can still read the records of
+/// threads that have exited; new threads reuse the buffers of exited ones.
+struct TraceRegistry {
+    std::mutex                                mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::vector<TraceBuffer *>                free_buffers;
+};
+
+TraceRegistry &registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+/// \brief Owner of the calling thread's trace buffer, returning it to the
+/// registry when the thread exits.
+struct TraceBufferLease {
+    ~TraceBufferLease() {
+        if (this->buffer != nullptr) {
+            TraceRegistry              &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.free_buffers.push_back(this->buffer);
+        }
+    }
+
+    TraceBuffer *buffer = nullptr;
+};
+
+std::atomic<std::uint64_t> next_trace_id(1);
+
+thread_local TraceBufferLease thread_buffer;
+thread_local std::uint32_t    thread_sample_count = 0;
+thread_local std::uint64_t    thread_current_id   = 0;
+
+TraceBuffer *acquire_buffer() {
+    TraceRegistry              &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (!reg.free_buffers.empty()) {
+        TraceBuffer *buffer = reg.free_buffers.back();
+        reg.free_buffers.pop_back();
+        return buffer;
+    }
+
+    auto index = static_cast<std::uint32_t>(reg.buffers.size());
+    reg.buffers.push_back(std::make_unique<TraceBuffer>(index));
+    return reg.buffers.back().get();
+}
+
+/// \brief Name of the interval ending at a stage.
+const char *interval_name(TraceStage stage) noexcept {
+    switch (stage) {
+    case TraceStage::FRAMED:
+        return "read";
+    case TraceStage::ROUTED:
+        return "route";
+    case TraceStage::ENQUEUED:
+        return "enqueue";
+    case TraceStage::WRITTEN:
+        return "queued";
+    default:
+        return "unknown";
+    }
+}
+
+} // namespace
+
+void Tracer::configure(std::uint32_t sample_every) noexcept {
+    sample_every_.store(sample_every, std::memory_order_relaxed);
+}
+
+std::uint64_t Tracer::now() noexcept {
+    struct timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL +
+           static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+void Tracer::record(std::uint64_t id,
+                    TraceStage    stage,
+                    int           sock_fd,
+                    std::uint64_t time) noexcept {
+    TraceBuffer *buffer = thread_buffer.buffer;
+    if (buffer == nullptr) {
+        try {
+            buffer = acquire_buffer();
+        } catch (const std::exception &) {
+            return; // Out of memory: drop the record
+        }
+
+        thread_buffer.buffer = buffer;
+    }
+
+    // Only this thread writes the buffer; the release store on head
+    // publishes the slot to dump().
+    std::uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    TraceSlot    &slot = buffer->slots[head % TRACE_BUFFER_SIZE];
+    slot.id.store(id, std::memory_order_relaxed);
+    slot.time.store(time, std::memory_order_relaxed);
+    slot.sock_fd.store(sock_fd, std::memory_order_relaxed);
+    slot.stage.store(stage, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::record(std::uint64_t id,
+                    TraceStage    stage,
+                    int           sock_fd) noexcept {
+    record(id, stage, sock_fd, now());
+}
+
+void Tracer::set_current(std::uint64_t id) noexcept { thread_current_id = id; }
+
+std::uint64_t Tracer::current() noexcept { return thread_current_id; }
+
+std::uint64_t Tracer::next_sample() noexcept {
+    std::uint32_t every = sample_every_.load(std::memory_order_relaxed);
+    if (every == 0 || ++thread_sample_count < every) {
+        return 0;
+    }
+
+    thread_sample_count = 0;
+    return next_trace_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::size_t Tracer::dump(const std::string_view path) {
+    std::map<std::uint64_t, std::vector<TraceRecord>> messages;
+
+    {
+        TraceRegistry              &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto &buffer : reg.buffers) {
+            std::uint64_t head  = buffer->head.load(std::memory_order_acquire);
+            std::uint64_t first = head > TRACE_BUFFER_SIZE
+                                      ? head - TRACE_BUFFER_SIZE
+                                      : 0;
+
+            std::vector<std::pair<std::uint64_t, TraceRecord>> copied;
+            for (std::uint64_t i = first; i < head; ++i) {
+                const TraceSlot &slot = buffer->slots[i % TRACE_BUFFER_SIZE];
+                copied.push_back(
+                    {slot.id.load(std::memory_order_relaxed),
+                     {slot.time.load(std::memory_order_relaxed),
+                      slot.sock_fd.load(std::memory_order_relaxed),
+                      slot.stage.load(std::memory_order_relaxed),
+                      buffer->tid}});
+            }
+
+            // Slots the owner lapped while they were copied may be torn.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::uint64_t end = buffer->head.load(std::memory_order_relaxed);
+            std::uint64_t valid =
+                end > TRACE_BUFFER_SIZE ? end - TRACE_BUFFER_SIZE : 0;
+            for (std::uint64_t i = std::max(first, valid); i < head; ++i) {
+                auto &[id, record] = copied[i - first];
+                messages[id].push_back(record);
+            }
+        }
+    }
+
+    std::string out_path(path);
+    std::FILE  *out = std::fopen(out_path.c_str(), "w");
+    if (out == nullptr) {
+        throw std::runtime_error(std::string("trace: fopen: ") +
+                                 std::strerror(errno));
+    }
+
+    // Each stage closes the interval started by the stage before it; the
+    // per-recipient stages pair up by socket.
+    std::size_t events = 0;
+    std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (auto &[id, records] : messages) {
+        std::sort(records.begin(),
+                  records.end(),
+                  [](const TraceRecord &a, const TraceRecord &b) {
+                      return a.time < b.time;
+                  });
+
+        for (const TraceRecord &end : records) {
+            if (end.stage == TraceStage::RECV) {
+                continue;
+            }
+
+            auto previous =
+                static_cast<TraceStage>(static_cast<int>(end.stage) - 1);
+            auto start = std::find_if(
+                records.begin(), records.end(), [&](const TraceRecord &r) {
+                    return r.stage == previous &&
+                           (previous != TraceStage::ENQUEUED ||
+                            r.sock_fd == end.sock_fd);
+                });
+            if (start == records.end()) {
+                continue; // Overwritten or never reached
+            }
+
+            std::fprintf(out,
+                         "%s\n{\"name\":\"%s\",\"cat\":\"message\","
+                         "\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                         "\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"args\":{\"id\":%llu,\"fd\":%d}}",
+                         events == 0 ? "" : ",",
+                         interval_name(end.stage),
+                         end.tid,
+                         static_cast<double>(start->time) / 1000.0,
+                         static_cast<double>(end.time - start->time) / 1000.0,
+                         static_cast<unsigned long long>(id),
+                         end.sock_fd);
+            ++events;
+        }
+    }
+
+    std::fprintf(out, "\n]}\n");
+    if (std::fclose(out) != 0) {
+        throw std::runtime_error(std::string("trace: fclose: ") +
+                                 std::strerror(errno));
+    }
+
+    return events;
+}
+
+} // namespace core
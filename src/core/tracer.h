@@ -0,0 +1,115 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file tracer.h
+/// Sampling message tracer for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_TRACER_H
+#define NOHUB_CORE_TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace core {
+
+/// \brief Stage of a message's life recorded by the tracer.
+enum class TraceStage : std::uint8_t {
+    RECV     = 0, ///< Bytes holding the message returned by recv.
+    FRAMED   = 1, ///< Message split off the receive buffer.
+    ROUTED   = 2, ///< Recipients of the message resolved.
+    ENQUEUED = 3, ///< Message queued for one recipient.
+    WRITTEN  = 4, ///< Message fully handed to one recipient's socket.
+};
+
+/// \brief Records timestamps of sampled messages into per-thread buffers.
+///
+/// Each thread appends to its own fixed-size ring, so recording takes no
+/// lock; old records are overwritten. When tracing is off, sample() costs a
+/// single relaxed load and nothing else is recorded.
+class Tracer {
+  public:
+    Tracer() = delete;
+
+    /// \brief Enable or disable tracing.
+    ///
+    /// \param sample_every Trace one message out of this many received by
+    /// each thread (0 to disable tracing).
+    static void configure(std::uint32_t sample_every) noexcept;
+
+    /// \brief Check whether tracing is enabled.
+    ///
+    /// \return True if messages are being sampled.
+    static bool enabled() noexcept {
+        return sample_every_.load(std::memory_order_relaxed) != 0;
+    }
+
+    /// \brief Decide whether to trace the next message of the calling thread.
+    ///
+    /// \return Trace identifier of the message, or 0 if it is not traced.
+    static std::uint64_t sample() noexcept {
+        return enabled() ? next_sample() : 0;
+    }
+
+    /// \brief Get the current monotonic time.
+    ///
+    /// \return Time in nanoseconds.
+    static std::uint64_t now() noexcept;
+
+    /// \brief Record a stage of a traced message.
+    ///
+    /// \param id Trace identifier returned by sample().
+    /// \param stage Stage reached.
+    /// \param sock_fd Socket the stage relates to, or -1.
+    /// \param time Time the stage was reached, from now().
+    static void record(std::uint64_t id,
+                       TraceStage    stage,
+                       int           sock_fd,
+                       std::uint64_t time) noexcept;
+
+    /// \brief Record a stage of a traced message, reached now.
+    ///
+    /// \param id Trace identifier returned by sample().
+    /// \param stage Stage reached.
+    /// \param sock_fd Socket the stage relates to, or -1.
+    static void
+    record(std::uint64_t id, TraceStage stage, int sock_fd) noexcept;
+
+    /// \brief Set the message being routed by the calling thread, so that
+    /// code further down the call chain can tag its records.
+    ///
+    /// \param id Trace identifier, or 0 once routing is done.
+    static void set_current(std::uint64_t id) noexcept;
+
+    /// \brief Get the message being routed by the calling thread.
+    ///
+    /// \return Trace identifier, or 0 if no traced message is being routed.
+    static std::uint64_t current() noexcept;
+
+    /// \brief Write every buffered record as Chrome trace-event JSON, with
+    /// one complete event per interval between consecutive stages.
+    ///
+    /// \param path Output file path.
+    /// \return Number of events written.
+    /// \throws std::runtime_error if the file cannot be written.
+    static std::size_t dump(const std::string_view path);
+
+  private:
+    /// Count a message of the calling thread against the sampling rate.
+    ///
+    /// \return Trace identifier of the message, or 0 if it is not traced.
+    static std::uint64_t next_sample() noexcept;
+
+    static inline std::atomic<std::uint32_t> sample_every_{0};
+};
+
+} // namespace core
+
+#endif // NOHUB_CORE_TRACER_H
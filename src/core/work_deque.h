@@ -0,0 +1,176 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file work_deque.h
+/// Lock-free work-stealing deque for the NoHub project.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef NOHUB_CORE_WORK_DEQUE_H
+#define NOHUB_CORE_WORK_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace core {
+
+/// \brief Chase-Lev work-stealing deque.
+///
+/// The owning thread pushes and pops at the bottom, any other thread steals
+/// from the top. The memory orderings follow Lê et al., "Correct and
+/// Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+///
+/// \tparam T Trivially copyable element type, typically a pointer.
+template <typename T> class WorkDeque {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "WorkDeque elements must be trivially copyable");
+
+  public:
+    /// \brief Constructor for WorkDeque class.
+    ///
+    /// \param capacity Initial capacity, rounded up to a power of two.
+    explicit WorkDeque(std::size_t capacity = 256)
+        : top_(0), bottom_(0), array_(nullptr) {
+        std::size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+
+        this->arrays_.push_back(std::make_unique<Array>(rounded));
+        this->array_.store(this->arrays_.back().get(),
+                           std::memory_order_relaxed);
+    }
+
+    /// \brief Delete copy constructor and copy assignment operator.
+    WorkDeque(const WorkDeque &)            = delete;
+    WorkDeque &operator=(const WorkDeque &) = delete;
+
+    /// \brief Push an element at the bottom. Owner thread only.
+    ///
+    /// \param item Element to push.
+    void push(T item) {
+        std::int64_t b = this->bottom_.load(std::memory_order_relaxed);
+        std::int64_t t = this->top_.load(std::memory_order_acquire);
+        Array       *a = this->array_.load(std::memory_order_relaxed);
+
+        if (b - t > static_cast<std::int64_t>(a->capacity) - 1) {
+            a = grow(a, b, t);
+        }
+
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        this->bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// \brief Pop the most recently pushed element. Owner thread only.
+    ///
+    /// \return The element, or std::nullopt if the deque is empty.
+    std::optional<T> pop() {
+        std::int64_t b = this->bottom_.load(std::memory_order_relaxed) - 1;
+        Array       *a = this->array_.load(std::memory_order_relaxed);
+        this->bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = this->top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            this->bottom_.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt; // Empty
+        }
+
+        T item = a->get(b);
+        if (t == b) {
+            // Last element: race against thieves for it.
+            bool won = this->top_.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            this->bottom_.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+                return std::nullopt;
+            }
+        }
+
+        return item;
+    }
+
+    /// \brief Steal the oldest element. Any thread.
+    ///
+    /// \return The element, or std::nullopt if the deque is empty or the
+    /// steal lost a race.
+    std::optional<T> steal() {
+        std::int64_t t = this->top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t b = this->bottom_.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return std::nullopt; // Empty
+        }
+
+        Array *a    = this->array_.load(std::memory_order_acquire);
+        T      item = a->get(t);
+        bool won = this->top_.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        if (!won) {
+            return std::nullopt; // Lost the race
+        }
+
+        return item;
+    }
+
+  private:
+    /// \brief Circular buffer of elements.
+    ///
+    /// Slots are accessed with acquire/release ordering, slightly stronger
+    /// than the paper requires, so that what an element points to is
+    /// published to thieves without relying on fences alone.
+    struct Array {
+        explicit Array(std::size_t cap)
+            : capacity(cap), items(std::make_unique<std::atomic<T>[]>(cap)) {}
+
+        T get(std::int64_t index) const noexcept {
+            return this->items[static_cast<std::size_t>(index) &
+                               (this->capacity - 1)]
+                .load(std::memory_order_acquire);
+        }
+
+        void put(std::int64_t index, T item) noexcept {
+            this->items[static_cast<std::size_t>(index) & (this->capacity - 1)]
+                .store(item, std::memory_order_release);
+        }
+
+        std::size_t                       capacity;
+        std::unique_ptr<std::atomic<T>[]> items;
+    };
+
+    /// \brief Replace the buffer with one twice as large.
+    ///
+    /// Old buffers are kept alive until the deque is destroyed, since a thief
+    /// may still be reading from them.
+    Array *grow(Array *old, std::int64_t bottom, std::int64_t top) {
+        auto bigger = std::make_unique<Array>(old->capacity * 2);
+        for (std::int64_t i = top; i < bottom; ++i) {
+            bigger->put(i, old->get(i));
+        }
+
+        Array *raw = bigger.get();
+        this->arrays_.push_back(std::move(bigger));
+        this->array_.store(raw, std::memory_order_release);
+        return raw;
+    }
+
+    alignas(64) std::atomic<std::int64_t> top_;
+    alignas(64) std::atomic<std::int64_t> bottom_;
+    std::atomic<Array *>                  array_;
+    std::vector<std::unique_ptr<Array>>   arrays_;
+};
+
+} // namespace core
+
+#endif // NOHUB_CORE_WORK_DEQUE_H
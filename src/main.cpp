@@ -15,6 +15,52 @@
 #include "program.h"
 
 #include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// \brief Build the server options from the program options.
+///
+/// \param options Parsed program options.
+/// \return The server options.
+/// \throws std::invalid_argument if the socket profile is unknown.
+static core::ServerOptions
+make_server_options(const program::ProgramOptions &options) {
+    core::ServerOptions server_options;
+    server_options.handoff_path           = options.handoff_path;
+    server_options.takeover_path          = options.takeover_path;
+    server_options.cpus                   = options.cpus;
+    server_options.busy_poll_us           = options.busy_poll_us;
+    server_options.max_connections        = options.max_connections;
+    server_options.max_connections_per_ip = options.max_connections_per_ip;
+    server_options.accept_rate            = options.accept_rate;
+    server_options.workers                = options.workers;
+    server_options.fanout_chunk           = options.fanout_chunk;
+    server_options.lane_weights           = options.lane_weights;
+    server_options.bulk_threshold         = options.bulk_threshold;
+    server_options.zerocopy_threshold     = options.zerocopy_threshold;
+    server_options.conflate_channels      = options.conflate_channels;
+    server_options.trace_sample           = options.trace_sample;
+    server_options.trace_path             = options.trace_path;
+    server_options.multicast_group        = options.multicast_group;
+    server_options.multicast_port         = options.multicast_port;
+    server_options.multicast_interface    = options.multicast_interface;
+    server_options.multicast_channels     = options.multicast_channels;
+    server_options.reliable_channels      = options.reliable_channels;
+    server_options.reliable_window        = options.reliable_window;
+    server_options.reliable_timeout_ms    = options.reliable_timeout_ms;
+    server_options.record_path            = options.record_path;
+    server_options.max_line               = options.max_line;
+    server_options.connection_memory      = options.connection_memory;
+    server_options.memory_budget          = options.memory_budget;
+    server_options.memory_policy          = options.memory_policy == "pause"
+                                                ? core::ShedPolicy::PAUSE
+                                                : core::ShedPolicy::EVICT;
+    server_options.socket_tuning =
+        core::SocketTuning::profile(options.socket_profile);
+
+    return server_options;
+}
 
 /// \brief Main entry point for the NoHub CLI tool.
 ///
@@ -42,11 +88,45 @@ int main(int argc, char **argv) {
     }
 
     try {
-        if (options.mode == program::MODE_CLIENT) {
+        if (options.mode == program::MODE_CLIENT && options.multicast) {
+            core::Client::run_multicast(
+                options.host, options.port, options.multicast_interface);
+        } else if (options.mode == program::MODE_CLIENT) {
             core::Client client(options.host, options.port);
-            client.run_interactive();
+            if (options.pipe) {
+                client.run_pipe();
+            } else {
+                client.run_interactive();
+            }
         } else if (options.mode == program::MODE_SERVER) {
-            core::Server server(options.port);
+            core::ServerOptions server_options = make_server_options(options);
+            if (!options.config_path.empty()) {
+                // Each reload parses the command line again, so the file is
+                // applied over the defaults and the flags exactly as at
+                // startup: a key removed from the file returns to its
+                // default instead of keeping the value it had.
+                std::vector<std::string> args(argv, argv + argc);
+                server_options.config_path = options.config_path;
+                server_options.reload      = [args]() {
+                    std::vector<std::string> words = args;
+                    std::vector<char *>      word_ptrs;
+                    for (std::string &word : words) {
+                        word_ptrs.push_back(word.data());
+                    }
+
+                    program::ProgramOptions reloaded;
+                    program::parse_arguments(static_cast<int>(word_ptrs.size()),
+                                             word_ptrs.data(),
+                                             reloaded);
+                    if (reloaded.error_code != 0) {
+                        throw std::invalid_argument(reloaded.error_msg);
+                    }
+
+                    return make_server_options(reloaded);
+                };
+            }
+
+            core::Server server(options.port, server_options);
             server.run();
         }
     } catch (const std::exception &e) {
@@ -12,14 +12,86 @@
 
 #include "program.h"
 
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <cfloat>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <sched.h>
+#include <unistd.h>
 #include <vector>
 
 namespace program {
 
+namespace {
+
+/// \brief Strip leading and trailing blanks, including carriage returns.
+///
+/// \param text The text.
+/// \return View of the text without surrounding blanks.
+std::string_view trim(std::string_view text) noexcept {
+    std::size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) {
+        return std::string_view();
+    }
+
+    std::size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+/// \brief Parse a number that must lie within [min, max].
+///
+/// \param text The whole text of the number.
+/// \param min Smallest accepted value.
+/// \param max Largest accepted value.
+/// \param value Receives the number on success.
+/// \return True on success, false if the text is not a number or is out of
+/// range.
+template <typename T>
+bool parse_number(const std::string_view text, const T min, const T max,
+                  T &value) noexcept {
+    T    parsed{};
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), parsed);
+    if (ec != std::errc() || end != text.data() + text.size() ||
+        !(parsed >= min && parsed <= max)) {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+/// \brief Load a numeric configuration key, if present, into \p value.
+///
+/// On a malformed or out-of-range value the error is reported through
+/// \p options and \p value is left untouched.
+///
+/// \return False if the key is present and invalid.
+template <typename T>
+bool load_number(std::unordered_map<std::string, std::string> &config,
+                 const std::string &key, const T min, const T max, T &value,
+                 ProgramOptions &options) {
+    auto it = config.find(key);
+    if (it == config.end()) {
+        return true;
+    }
+
+    if (!parse_number(std::string_view(it->second), min, max, value)) {
+        options.error_msg  = "Invalid " + key + " in config: " + it->second;
+        options.error_code = 1;
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
 void parse_arguments(int argc, char **argv, ProgramOptions &options) {
     std::vector<std::string_view> args(argv + 1, argv + argc);
+    int                           argc_flags = 0;
 
     for (auto it = args.begin(); it != args.end(); ++it) {
         if (*it == "--help" || *it == "-h") {
@@ -36,10 +108,47 @@ void parse_arguments(int argc, char **argv, ProgramOptions &options) {
                 return;
             }
 
+            options.config_path = std::string(*it);
             load_config_file(*it, options);
             continue;
         }
 
+        if (*it == "--pipe" || *it == "-p") {
+            options.pipe = true;
+            ++argc_flags;
+            continue;
+        }
+
+        if (*it == "--multicast" || *it == "-m") {
+            options.multicast = true;
+            ++argc_flags;
+            continue;
+        }
+
+        if (*it == "--handoff" || *it == "--takeover" || *it == "--record") {
+            std::string_view flag = *it;
+            ++it;
+            if (it == args.end()) {
+                std::string expected =
+                    flag == "--record" ? "file path" : "socket path";
+                options.error_msg  = "Expected " + expected + " after " +
+                                     std::string(flag) + ".";
+                options.error_code = 1;
+                return;
+            }
+
+            if (flag == "--handoff") {
+                options.handoff_path = std::string(*it);
+            } else if (flag == "--takeover") {
+                options.takeover_path = std::string(*it);
+            } else {
+                options.record_path = std::string(*it);
+            }
+
+            argc_flags += 2;
+            continue;
+        }
+
         if (options.mode == MODE_UNDEFINED) {
             if (*it == "client") {
                 options.mode = MODE_CLIENT;
@@ -62,14 +171,13 @@ void parse_arguments(int argc, char **argv, ProgramOptions &options) {
         }
 
         if (options.port == 0) {
-            int port = std::stoi(std::string(*it));
-            if (port < 0 || port > 65535) {
+            if (!parse_number<std::uint16_t>(*it, 0, UINT16_MAX,
+                                             options.port)) {
                 options.error_msg  = "Invalid port: " + std::string(*it);
                 options.error_code = 1;
                 return;
             }
 
-            options.port = static_cast<std::uint16_t>(port);
             continue;
         }
 
@@ -78,16 +186,18 @@ void parse_arguments(int argc, char **argv, ProgramOptions &options) {
         return;
     }
 
+    int argc_positional = argc - argc_flags;
     if (!options.show_help &&
-        (((options.mode == program::MODE_CLIENT) && (argc < 4)) ||
-         ((options.mode == program::MODE_SERVER) && (argc < 3)))) {
+        (((options.mode == program::MODE_CLIENT) && (argc_positional < 4)) ||
+         ((options.mode == program::MODE_SERVER) && (argc_positional < 3)))) {
         options.error_msg  = "Insufficient arguments provided.";
         options.error_code = 1;
     }
 }
 
 void print_usage(const std::string_view progname) {
-    std::printf("Usage: %s [-h] [-c <file>] <mode> <ip> <port>\n",
+    std::printf("Usage: %s [-h] [-c <file>] [-p] [-m] [--handoff <path>] "
+                "[--takeover <path>] [--record <file>] <mode> <ip> <port>\n",
                 progname.data());
 }
 
@@ -96,13 +206,29 @@ void print_help(const std::string_view progname) {
     std::printf("\nOptions:\n"
                 "-h, --help\t\tShow this help message and exit.\n"
                 "-c, --config <file>\tSpecify a configuration file.\n"
+                "-p, --pipe\t\tClient: stream stdin to the server in bulk.\n"
+                "-m, --multicast\t\tClient: print messages published to the "
+                "multicast\n\t\t\tgroup <ip> on <port>.\n"
+                "--handoff <path>\tServer: accept hot restarts on a Unix "
+                "socket.\n"
+                "--takeover <path>\tServer: take over the sockets of the "
+                "server\n\t\t\thandling hot restarts on <path>.\n"
+                "--record <file>\t\tServer: record client sessions for "
+                "nohub-replay.\n"
                 "<mode>\t\t\tSet the program mode (client or server).\n"
                 "<ip>\t\t\tSet the IP address to bind/connect to.\n"
                 "<port>\t\t\tSet the port number to bind/connect to.\n");
     std::printf("\nExamples:\n"
                 "  %sserver 4444\n"
                 "  %sclient 127.0.0.1 4444\n"
-                "  %sclient -c my.conf\n",
+                "  %sclient -c my.conf\n"
+                "  %sclient -p 127.0.0.1 4444 < events.log\n"
+                "  %s-m client 239.255.0.1 5700\n"
+                "  %s--takeover /run/nohub.sock --handoff /run/nohub.sock "
+                "server 4444\n",
+                progname.data(),
+                progname.data(),
+                progname.data(),
                 progname.data(),
                 progname.data(),
                 progname.data());
@@ -111,24 +237,137 @@ void print_help(const std::string_view progname) {
 std::unordered_map<std::string, std::string>
 read_config_file(const std::string_view filepath) {
     std::unordered_map<std::string, std::string> config;
-    std::ifstream                                file(filepath.data());
-    if (!file.is_open()) {
+    std::FILE *file = std::fopen(std::string(filepath).c_str(), "rb");
+    if (file == nullptr) {
         return config;
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream line_stream(line);
-        std::string        key, value;
-        if (std::getline(line_stream, key, '=') &&
-            std::getline(line_stream, value)) {
-            config[key] = value;
+    // The file is read whole and split in place, without a stream or a
+    // copy per line.
+    std::string contents;
+    char        chunk[8192];
+    std::size_t bytes_read;
+    while ((bytes_read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.append(chunk, bytes_read);
+    }
+
+    std::fclose(file);
+
+    std::string_view rest(contents);
+    while (!rest.empty()) {
+        std::size_t      newline = rest.find('\n');
+        std::string_view line    = rest.substr(0, newline);
+        rest.remove_prefix(std::min(line.size() + 1, rest.size()));
+
+        std::size_t equals = line.find('=');
+        if (line.empty() || line.front() == '#' ||
+            equals == std::string_view::npos) {
+            continue;
+        }
+
+        std::string_view key   = trim(line.substr(0, equals));
+        std::string_view value = trim(line.substr(equals + 1));
+        if (!key.empty() && !value.empty()) {
+            config.insert_or_assign(std::string(key), std::string(value));
         }
     }
 
     return config;
 }
 
+bool parse_cpu_list(const std::string_view list, std::vector<int> &cpus) {
+    // Bounding the ranges also keeps CPU_SET() within its fixed-size set.
+    long configured = ::sysconf(_SC_NPROCESSORS_CONF);
+    int  cpu_limit  = configured > 0 && configured < CPU_SETSIZE
+                          ? static_cast<int>(configured)
+                          : CPU_SETSIZE;
+
+    std::vector<int> parsed;
+    std::size_t      start = 0;
+
+    while (start <= list.size()) {
+        std::size_t end = list.find(',', start);
+        if (end == std::string_view::npos) {
+            end = list.size();
+        }
+
+        std::string_view item  = list.substr(start, end - start);
+        std::size_t      dash  = item.find('-');
+        std::string_view first = item.substr(0, dash);
+        std::string_view last =
+            dash == std::string_view::npos ? first : item.substr(dash + 1);
+
+        int low  = -1;
+        int high = -1;
+        auto [first_end, first_ec] =
+            std::from_chars(first.data(), first.data() + first.size(), low);
+        auto [last_end, last_ec] =
+            std::from_chars(last.data(), last.data() + last.size(), high);
+        if (first_ec != std::errc() || last_ec != std::errc() ||
+            first_end != first.data() + first.size() ||
+            last_end != last.data() + last.size() || low < 0 || high < low ||
+            high >= cpu_limit) {
+            return false;
+        }
+
+        for (int cpu = low; cpu <= high; ++cpu) {
+            parsed.push_back(cpu);
+        }
+
+        start = end + 1;
+    }
+
+    cpus = std::move(parsed);
+    return true;
+}
+
+std::vector<std::string> parse_name_list(const std::string_view list) {
+    std::vector<std::string> names;
+    std::string_view         rest = list;
+
+    while (!rest.empty()) {
+        std::string_view name = rest.substr(0, rest.find(','));
+        if (!name.empty()) {
+            names.emplace_back(name);
+        }
+
+        rest.remove_prefix(std::min(name.size() + 1, rest.size()));
+    }
+
+    return names;
+}
+
+bool parse_lane_weights(const std::string_view   list,
+                        std::array<unsigned, 3> &weights) {
+    std::array<unsigned, 3> parsed{};
+    const char             *pos = list.data();
+    const char             *end = list.data() + list.size();
+
+    for (std::size_t i = 0; i < parsed.size(); ++i) {
+        if (i > 0) {
+            if (pos == end || *pos != ',') {
+                return false;
+            }
+
+            ++pos;
+        }
+
+        auto [next, ec] = std::from_chars(pos, end, parsed[i]);
+        if (ec != std::errc() || parsed[i] == 0) {
+            return false;
+        }
+
+        pos = next;
+    }
+
+    if (pos != end) {
+        return false;
+    }
+
+    weights = parsed;
+    return true;
+}
+
 void load_config_file(const std::string_view filepath,
                       ProgramOptions        &options) {
     auto config = read_config_file(filepath);
@@ -149,16 +388,119 @@ void load_config_file(const std::string_view filepath,
         options.host = config["host"];
     }
 
-    if (config.find("port") != config.end()) {
-        int port = std::stoi(config["port"]);
-        if (port < 0 || port > 65535) {
-            options.error_msg  = "Invalid port in config: " + config["port"];
+    if (config.find("handoff") != config.end()) {
+        options.handoff_path = config["handoff"];
+    }
+
+    if (config.find("cpus") != config.end()) {
+        if (!parse_cpu_list(config["cpus"], options.cpus)) {
+            options.error_msg  = "Invalid cpus in config: " + config["cpus"];
+            options.error_code = 1;
+            return;
+        }
+    }
+
+    if (!load_number(config, "busy_poll", 0, INT_MAX, options.busy_poll_us,
+                     options) ||
+        !load_number<std::size_t>(config, "max_connections", 0, SIZE_MAX,
+                                  options.max_connections, options) ||
+        !load_number<std::size_t>(config, "max_connections_per_ip", 0, SIZE_MAX,
+                                  options.max_connections_per_ip, options) ||
+        !load_number(config, "accept_rate", 0.0, DBL_MAX, options.accept_rate,
+                     options)) {
+        return;
+    }
+
+    if (config.find("socket_profile") != config.end()) {
+        options.socket_profile = config["socket_profile"];
+    }
+
+    if (!load_number<std::size_t>(config, "workers", 0, SIZE_MAX,
+                                  options.workers, options) ||
+        !load_number<std::size_t>(config, "fanout_chunk", 1, SIZE_MAX,
+                                  options.fanout_chunk, options)) {
+        return;
+    }
+
+    if (config.find("lane_weights") != config.end()) {
+        if (!parse_lane_weights(config["lane_weights"], options.lane_weights)) {
+            options.error_msg =
+                "Invalid lane_weights in config: " + config["lane_weights"];
             options.error_code = 1;
             return;
         }
+    }
+
+    if (!load_number<std::size_t>(config, "bulk_threshold", 0, SIZE_MAX,
+                                  options.bulk_threshold, options) ||
+        !load_number<std::size_t>(config, "zerocopy_threshold", 0, SIZE_MAX,
+                                  options.zerocopy_threshold, options)) {
+        return;
+    }
+
+    if (config.find("conflate_channels") != config.end()) {
+        options.conflate_channels =
+            parse_name_list(config["conflate_channels"]);
+    }
 
-        options.port = static_cast<std::uint16_t>(port);
+    if (!load_number<std::uint32_t>(config, "trace_sample", 0, UINT32_MAX,
+                                    options.trace_sample, options)) {
+        return;
+    }
+
+    if (config.find("trace_file") != config.end()) {
+        options.trace_path = config["trace_file"];
+    }
+
+    if (config.find("multicast_group") != config.end()) {
+        options.multicast_group = config["multicast_group"];
+    }
+
+    if (!load_number<std::uint16_t>(config, "multicast_port", 1, UINT16_MAX,
+                                    options.multicast_port, options)) {
+        return;
     }
+
+    if (config.find("multicast_interface") != config.end()) {
+        options.multicast_interface = config["multicast_interface"];
+    }
+
+    if (config.find("multicast_channels") != config.end()) {
+        options.multicast_channels =
+            parse_name_list(config["multicast_channels"]);
+    }
+
+    if (config.find("reliable_channels") != config.end()) {
+        options.reliable_channels =
+            parse_name_list(config["reliable_channels"]);
+    }
+
+    if (!load_number<std::size_t>(config, "reliable_window", 1, SIZE_MAX,
+                                  options.reliable_window, options) ||
+        !load_number(config, "reliable_timeout", 1, INT_MAX,
+                     options.reliable_timeout_ms, options) ||
+        !load_number<std::size_t>(config, "max_line", 0, SIZE_MAX,
+                                  options.max_line, options) ||
+        !load_number<std::size_t>(config, "connection_memory", 0, SIZE_MAX,
+                                  options.connection_memory, options) ||
+        !load_number<std::size_t>(config, "memory_budget", 0, SIZE_MAX,
+                                  options.memory_budget, options)) {
+        return;
+    }
+
+    if (config.find("memory_policy") != config.end()) {
+        options.memory_policy = config["memory_policy"];
+        if (options.memory_policy != "evict" &&
+            options.memory_policy != "pause") {
+            options.error_msg =
+                "Invalid memory_policy in config: " + options.memory_policy;
+            options.error_code = 1;
+            return;
+        }
+    }
+
+    load_number<std::uint16_t>(config, "port", 0, UINT16_MAX, options.port,
+                               options);
 }
 
 } // namespace program
@@ -13,27 +13,132 @@
 #ifndef PROGRAM_H
 #define PROGRAM_H
 
+#include <array>
 #include <cstdint>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 namespace program {
 
 /// \brief Enumeration for program modes.
 typedef enum { MODE_UNDEFINED = 0, MODE_CLIENT, MODE_SERVER } ProgramMode;
 
-/// \brief Structure to hold parsed program options.
-///
-/// This structure contains the mode, host, port, error messages,
-/// error codes, and a flag to indicate if help should be shown.
+/// \brief Options parsed from the command line and the configuration file.
 struct ProgramOptions {
-    ProgramMode   mode       = MODE_UNDEFINED;
-    std::string   host       = std::string();
-    std::uint16_t port       = 0;
-    std::string   error_msg  = std::string();
-    int           error_code = EXIT_SUCCESS;
-    bool          show_help  = false;
+    /// Whether to run as a client or a server.
+    ProgramMode mode = MODE_UNDEFINED;
+
+    /// Address to connect to, or multicast group to join, in client mode.
+    std::string host = std::string();
+
+    /// Port to bind or connect to.
+    std::uint16_t port = 0;
+
+    /// Description of the first invalid option (empty if all are valid).
+    std::string error_msg = std::string();
+
+    /// Exit code for an invalid option (EXIT_SUCCESS if all are valid).
+    int error_code = EXIT_SUCCESS;
+
+    /// Configuration file given with --config (empty if none).
+    std::string config_path = std::string();
+
+    /// True to print the help text and exit.
+    bool show_help = false;
+
+    /// True to stream stdin to the server in bulk (client only).
+    bool pipe = false;
+
+    /// True to print messages received from a multicast group (client
+    /// only).
+    bool multicast = false;
+
+    /// Unix socket path on which a successor can take over the server.
+    std::string handoff_path = std::string();
+
+    /// Unix socket path of a running server to take over.
+    std::string takeover_path = std::string();
+
+    /// CPUs the server threads are pinned to.
+    std::vector<int> cpus = {};
+
+    /// Busy polling time in microseconds (0 to disable).
+    int busy_poll_us = 0;
+
+    /// Maximum number of connected clients (0 for no limit).
+    std::size_t max_connections = 0;
+
+    /// Maximum number of connected clients per IP address (0 for no limit).
+    std::size_t max_connections_per_ip = 0;
+
+    /// Connections admitted per second (0 for no limit).
+    double accept_rate = 0.0;
+
+    /// Name of the socket tuning profile.
+    std::string socket_profile = "default";
+
+    /// Number of fan-out worker threads (0 for none).
+    std::size_t workers = 0;
+
+    /// Largest number of recipients a single worker task sends to.
+    std::size_t fanout_chunk = 64;
+
+    /// Frames sent from the control, normal and bulk lanes per round.
+    std::array<unsigned, 3> lane_weights = {8, 4, 1};
+
+    /// Size in bytes from which a message is sent on the bulk lane.
+    std::size_t bulk_threshold = 4096;
+
+    /// Size in bytes from which a message is sent with MSG_ZEROCOPY (0 to
+    /// disable).
+    std::size_t zerocopy_threshold = 0;
+
+    /// Channels keeping the last value published for each key.
+    std::vector<std::string> conflate_channels = {};
+
+    /// Trace one message out of this many (0 to disable tracing).
+    std::uint32_t trace_sample = 0;
+
+    /// File the message trace is written to.
+    std::string trace_path = "nohub-trace.json";
+
+    /// Multicast group published messages are sent to (empty to disable).
+    std::string multicast_group = std::string();
+
+    /// Destination port of multicast datagrams.
+    std::uint16_t multicast_port = 5700;
+
+    /// Address of the interface multicast datagrams leave from.
+    std::string multicast_interface = std::string();
+
+    /// Channels whose messages are sent to the multicast group.
+    std::vector<std::string> multicast_channels = {};
+
+    /// Channels delivered at least once.
+    std::vector<std::string> reliable_channels = {};
+
+    /// Unacknowledged messages kept per subscriber of a reliable channel.
+    std::size_t reliable_window = 4096;
+
+    /// Time in milliseconds before unacknowledged messages are sent again.
+    int reliable_timeout_ms = 1000;
+
+    /// File client sessions are recorded to (empty to disable).
+    std::string record_path = std::string();
+
+    /// Longest line accepted from a client (0 for no limit).
+    std::size_t max_line = 1024 * 1024;
+
+    /// Bytes a single client may hold (0 for no limit).
+    std::size_t connection_memory = 0;
+
+    /// Bytes all clients together may hold (0 for no limit).
+    std::size_t memory_budget = 0;
+
+    /// What to do over the memory budget: "evict" or "pause".
+    std::string memory_policy = "evict";
 };
 
 /// \brief Parse command-line arguments.
@@ -59,13 +164,37 @@ void print_help(const std::string_view progname);
 /// \brief Read configuration from a file.
 ///
 /// This function reads key-value pairs from the specified configuration file
-/// and returns them as an unordered map.
+/// and returns them as an unordered map. Blanks around keys and values are
+/// ignored, as are lines starting with '#'. A key with an empty value is
+/// left out, as if it were not in the file, so it keeps its default.
 ///
 /// \param filepath Path to the configuration file.
 /// \return An unordered map containing the configuration key-value pairs.
 std::unordered_map<std::string, std::string>
 read_config_file(const std::string_view filepath);
 
+/// \brief Parse a CPU list such as "0-3,8".
+///
+/// \param list Comma-separated CPU numbers and inclusive ranges.
+/// \param cpus Vector receiving the CPU numbers.
+/// \return True on success, false if the list is malformed or names a CPU
+/// the system is not configured with.
+bool parse_cpu_list(const std::string_view list, std::vector<int> &cpus);
+
+/// \brief Parse a comma-separated list of names, skipping empty ones.
+///
+/// \param list The list.
+/// \return The names.
+std::vector<std::string> parse_name_list(const std::string_view list);
+
+/// \brief Parse control, normal and bulk lane weights such as "8,4,1".
+///
+/// \param list Three comma-separated positive integers.
+/// \param weights Array receiving the weights.
+/// \return True on success, false if the list is malformed.
+bool parse_lane_weights(const std::string_view   list,
+                        std::array<unsigned, 3> &weights);
+
 /// \brief Load configuration from a file into ProgramOptions.
 ///
 /// \param filepath Path to the configuration file.
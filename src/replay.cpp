@@ -0,0 +1,917 @@
+//===----------------------------------------------------------------------===//
+//
+// Part of the NoHub Project.
+// See LICENSE for license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file replay.cpp
+/// Replays recorded client sessions against a NoHub server.
+///
+/// Every recorded client is simulated by its own loopback connection, and
+/// its lines are sent at their recorded times, divided by the speed factor.
+/// Chat messages and published values get a message number appended, so
+/// that receivers can tell how long each one took to reach them.
+///
+//===----------------------------------------------------------------------===//
+
+#include "core/session_trace.h"
+#include "program.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// \brief Median latencies below this many microseconds are counted as this
+/// many in the tail ratio, as they are within scheduling noise.
+constexpr std::uint64_t LATENCY_SLACK_US = 100;
+
+/// \brief Largest number of events applied between two reads.
+constexpr std::size_t EVENT_BATCH = 64;
+
+/// \brief Time a started server gets to accept connections.
+constexpr int SERVER_START_MS = 5000;
+
+/// \brief Replay settings.
+struct ReplayOptions {
+    std::string   session_path       = std::string();
+    std::string   server_path        = std::string();
+    std::string   config_path        = std::string();
+    std::uint16_t port               = 0;
+    double        speed              = 1.0;
+    std::size_t   scale              = 1;
+    int           drain_ms           = 1000;
+    std::string   baseline_path      = std::string();
+    std::string   save_baseline_path = std::string();
+    double        tolerance          = 0.1;
+};
+
+/// \brief Measurements of a replay.
+struct ReplayResult {
+    std::size_t   clients    = 0;
+    std::size_t   failed     = 0;
+    std::size_t   events     = 0;
+    std::size_t   sent       = 0;
+    std::size_t   received   = 0;
+    double        seconds    = 0.0;
+    double        throughput = 0.0;
+    std::uint64_t max_lag_us = 0;
+    std::uint64_t p50_us     = 0;
+    std::uint64_t p90_us     = 0;
+    std::uint64_t p99_us     = 0;
+    std::uint64_t p999_us    = 0;
+    std::uint64_t max_us     = 0;
+    double        cpu_time   = 0.0;
+};
+
+/// \brief Simulated client.
+struct SimClient {
+    int         sock_fd    = -1;
+    bool        is_closing = false;
+    bool        is_writing = false;
+    std::string outbound   = std::string();
+    std::string inbound    = std::string();
+};
+
+/// \brief Print usage information for the replay tool.
+///
+/// \param progname Name of the program (argv[0]).
+void print_usage(const char *progname) {
+    std::printf("Usage: %s [-h] [--server <nohub>] [-c <file>] [--port <port>] "
+                "[--speed <x>]\n"
+                "       [--scale <n>] [--drain <ms>] [--baseline <file>] "
+                "[--save-baseline <file>]\n"
+                "       [--tolerance <fraction>] <session>\n",
+                progname);
+}
+
+/// \brief Print detailed help information for the replay tool.
+///
+/// \param progname Name of the program (argv[0]).
+void print_help(const char *progname) {
+    print_usage(progname);
+    std::printf(
+        "\nOptions:\n"
+        "-h, --help\t\tShow this help message and exit.\n"
+        "--server <nohub>\tStart this nohub binary on a free port and "
+        "replay\n\t\t\tagainst it.\n"
+        "-c, --config <file>\tConfiguration file of the started server.\n"
+        "--port <port>\t\tPort of the server (a running one unless "
+        "--server\n\t\t\tis given).\n"
+        "--speed <x>\t\tReplay x times faster than recorded (0 to send "
+        "as\n\t\t\tfast as possible, with every client staying "
+        "connected\n\t\t\tuntil the end; default 1).\n"
+        "--scale <n>\t\tSimulate n clients per recorded client (default "
+        "1).\n"
+        "--drain <ms>\t\tTime without traffic that ends the replay "
+        "(default\n\t\t\t1000).\n"
+        "--baseline <file>\tCompare the results with a baseline; exit with "
+        "an\n\t\t\terror if any of them regressed.\n"
+        "--save-baseline <file>\tWrite the throughput per CPU second and "
+        "p99/p50\n\t\t\tratio as a baseline.\n"
+        "--tolerance <fraction>\tRegression allowed against the baseline "
+        "(default\n\t\t\t0.1).\n"
+        "<session>\t\tSession recorded with nohub server --record.\n");
+}
+
+/// \brief Parse a whole argument as a number.
+///
+/// \param text The argument.
+/// \param value Receives the number.
+/// \return True on success.
+template <typename T> bool parse_number(std::string_view text, T &value) {
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+/// \brief Parse the command line.
+///
+/// \param argc Argument count.
+/// \param argv Argument vector.
+/// \param options Receives the settings.
+/// \return Error message, or empty on success.
+std::string parse_arguments(int argc, char **argv, ReplayOptions &options) {
+    std::vector<std::string_view> args(argv + 1, argv + argc);
+    for (auto it = args.begin(); it != args.end(); ++it) {
+        std::string_view flag = *it;
+        if (!flag.starts_with("-")) {
+            if (!options.session_path.empty()) {
+                return "Unexpected argument: " + std::string(flag);
+            }
+
+            options.session_path = std::string(flag);
+            continue;
+        }
+
+        if (++it == args.end()) {
+            return "Expected a value after " + std::string(flag) + ".";
+        }
+
+        std::string_view value = *it;
+        bool             valid = true;
+        if (flag == "--server") {
+            options.server_path = std::string(value);
+        } else if (flag == "--config" || flag == "-c") {
+            options.config_path = std::string(value);
+        } else if (flag == "--port") {
+            valid = parse_number(value, options.port) && options.port != 0;
+        } else if (flag == "--speed") {
+            valid = parse_number(value, options.speed) && options.speed >= 0.0;
+        } else if (flag == "--scale") {
+            valid = parse_number(value, options.scale) && options.scale > 0;
+        } else if (flag == "--drain") {
+            valid = parse_number(value, options.drain_ms) &&
+                    options.drain_ms > 0;
+        } else if (flag == "--baseline") {
+            options.baseline_path = std::string(value);
+        } else if (flag == "--save-baseline") {
+            options.save_baseline_path = std::string(value);
+        } else if (flag == "--tolerance") {
+            valid = parse_number(value, options.tolerance) &&
+                    options.tolerance >= 0.0;
+        } else {
+            return "Unknown option: " + std::string(flag);
+        }
+
+        if (!valid) {
+            return "Invalid value for " + std::string(flag) + ": " +
+                   std::string(value);
+        }
+    }
+
+    if (options.session_path.empty()) {
+        return "Expected a session file.";
+    }
+
+    if (options.server_path.empty() && options.port == 0) {
+        return "Expected --server or --port.";
+    }
+
+    return std::string();
+}
+
+/// \brief Get a loopback address.
+///
+/// \param port Port number.
+/// \return The address.
+struct sockaddr_in loopback(std::uint16_t port) {
+    struct sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+/// \brief Connect to the server.
+///
+/// \param port Port of the server.
+/// \return Non-blocking socket, or -1 on failure.
+int connect_client(std::uint16_t port) {
+    int sock_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_in addr = loopback(port);
+    if (::connect(sock_fd,
+                  reinterpret_cast<struct sockaddr *>(&addr),
+                  sizeof(addr)) < 0) {
+        ::close(sock_fd);
+        return -1;
+    }
+
+    int nodelay = 1;
+    ::setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    int flags = ::fcntl(sock_fd, F_GETFL, 0);
+    ::fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+    return sock_fd;
+}
+
+/// \brief Find a free loopback port.
+///
+/// \return The port.
+/// \throws std::runtime_error if no port can be reserved.
+std::uint16_t free_port() {
+    int sock_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        throw std::runtime_error(std::string("socket: ") +
+                                 std::strerror(errno));
+    }
+
+    struct sockaddr_in addr     = loopback(0);
+    socklen_t          addr_len = sizeof(addr);
+    if (::bind(sock_fd, reinterpret_cast<struct sockaddr *>(&addr),
+               sizeof(addr)) < 0 ||
+        ::getsockname(sock_fd,
+                      reinterpret_cast<struct sockaddr *>(&addr),
+                      &addr_len) < 0) {
+        ::close(sock_fd);
+        throw std::runtime_error(std::string("bind: ") + std::strerror(errno));
+    }
+
+    ::close(sock_fd);
+    return ntohs(addr.sin_port);
+}
+
+/// \brief Start a server and wait until it accepts connections.
+///
+/// Its output and log are discarded, so that the per-message logging does
+/// not dominate the measurements.
+///
+/// \param options Replay settings; the port is chosen if not set.
+/// \return Process ID of the server.
+/// \throws std::runtime_error if the server does not come up.
+pid_t start_server(ReplayOptions &options) {
+    if (options.port == 0) {
+        options.port = free_port();
+    }
+
+    std::string              port = std::to_string(options.port);
+    std::vector<std::string> args = {options.server_path};
+    if (!options.config_path.empty()) {
+        args.insert(args.end(), {"-c", options.config_path});
+    }
+
+    args.insert(args.end(), {"server", port});
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+    }
+
+    if (pid == 0) {
+        std::vector<char *> argv;
+        for (std::string &arg : args) {
+            argv.push_back(arg.data());
+        }
+
+        argv.push_back(nullptr);
+        int error_fd = ::fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        int null_fd  = ::open("/dev/null", O_WRONLY);
+        ::dup2(null_fd, STDOUT_FILENO);
+        ::dup2(null_fd, STDERR_FILENO);
+        ::execv(argv[0], argv.data());
+        ::dprintf(error_fd, "[-] execv: %s\n", std::strerror(errno));
+        ::_exit(127);
+    }
+
+    for (int waited_ms = 0; waited_ms < SERVER_START_MS; waited_ms += 10) {
+        int status;
+        if (::waitpid(pid, &status, WNOHANG) == pid) {
+            throw std::runtime_error("server exited on startup");
+        }
+
+        int sock_fd = connect_client(options.port);
+        if (sock_fd >= 0) {
+            ::close(sock_fd);
+            return pid;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+    throw std::runtime_error("server did not start listening");
+}
+
+/// \brief Stop a started server.
+///
+/// \param pid Process ID of the server.
+/// \return CPU time the server used, in seconds.
+double stop_server(pid_t pid) {
+    struct rusage usage{};
+    ::kill(pid, SIGTERM);
+    if (::wait4(pid, nullptr, 0, &usage) != pid) {
+        return 0.0;
+    }
+
+    auto seconds = [](const struct timeval &time) {
+        return static_cast<double>(time.tv_sec) +
+               static_cast<double>(time.tv_usec) / 1e6;
+    };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+/// \brief Get the lines delivered per second of server CPU time.
+///
+/// Unlike the wall-clock throughput, this changes little with the load
+/// and core count of the machine running the replay.
+///
+/// \param result The measurements.
+/// \return Lines per CPU second, or 0 if the server was not started here.
+double throughput_per_core(const ReplayResult &result) noexcept {
+    return result.cpu_time > 0.0
+               ? static_cast<double>(result.received) / result.cpu_time
+               : 0.0;
+}
+
+/// \brief Get the 99th percentile latency relative to the median.
+///
+/// \param result The measurements.
+/// \return The ratio.
+double tail_ratio(const ReplayResult &result) noexcept {
+    return static_cast<double>(result.p99_us) /
+           static_cast<double>(std::max(result.p50_us, LATENCY_SLACK_US));
+}
+
+/// \brief Check whether a line reaches other clients, and so can be timed.
+///
+/// \param line The line, including its newline.
+/// \return True for chat messages and published values.
+bool is_timed(std::string_view line) noexcept {
+    return line.ends_with('\n') &&
+           (!line.starts_with('/') || line.starts_with("/pub "));
+}
+
+/// \brief Get the message number a timed line was tagged with.
+///
+/// \param line The line, without its newline.
+/// \param id Receives the message number.
+/// \return True if the line carries a message number.
+bool parse_tag(std::string_view line, std::size_t &id) noexcept {
+    std::size_t tag = line.rfind(" ~");
+    return tag != std::string_view::npos &&
+           parse_number(line.substr(tag + 2), id);
+}
+
+/// \brief Replays a session over one connection per simulated client.
+class Replayer {
+  public:
+    /// \brief Constructor for Replayer class.
+    ///
+    /// \param options Replay settings.
+    /// \throws std::runtime_error if the epoll instance cannot be created.
+    explicit Replayer(const ReplayOptions &options)
+        : options_(options), epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)) {
+        if (this->epoll_fd_ < 0) {
+            throw std::runtime_error(std::string("epoll_create1: ") +
+                                     std::strerror(errno));
+        }
+    }
+
+    /// \brief Destructor for Replayer class.
+    ~Replayer() {
+        for (SimClient &client : this->clients_) {
+            if (client.sock_fd >= 0) {
+                ::close(client.sock_fd);
+            }
+        }
+
+        ::close(this->epoll_fd_);
+    }
+
+    /// \brief Replay a session.
+    ///
+    /// \param events The recorded events.
+    /// \return The measurements.
+    ReplayResult run(const std::vector<core::SessionEvent> &events) {
+        std::size_t scale = this->options_.scale;
+        for (const core::SessionEvent &event : events) {
+            std::size_t needed = (event.client + 1) * scale;
+            if (needed > this->clients_.size()) {
+                this->clients_.resize(needed);
+            }
+        }
+
+        this->start_        = Clock::now();
+        this->last_receive_ = this->start_;
+
+        ReplayResult      result;
+        std::size_t       next         = 0;
+        Clock::time_point last_event   = this->start_;
+        Clock::time_point last_traffic = this->start_;
+        while (true) {
+            // Events are applied in batches, so that clients keep reading
+            // while a replay without pauses is sending.
+            Clock::time_point now     = Clock::now();
+            std::size_t       applied = 0;
+            while (next < events.size() && applied < EVENT_BATCH &&
+                   due(events[next]) <= now) {
+                const core::SessionEvent &event = events[next++];
+                auto lag =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        now - due(event));
+                result.max_lag_us =
+                    std::max(result.max_lag_us,
+                             static_cast<std::uint64_t>(lag.count()));
+                for (std::size_t copy = 0; copy < scale; ++copy) {
+                    apply(event, event.client * scale + copy);
+                }
+
+                ++applied;
+                last_event   = now;
+                last_traffic = now;
+            }
+
+            int timeout_ms = this->options_.drain_ms;
+            if (next < events.size()) {
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+                    due(events[next]) - now);
+                timeout_ms = static_cast<int>(std::max<long>(wait.count(), 0));
+            } else {
+                auto idle =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        now - last_traffic);
+                if (idle.count() >= this->options_.drain_ms) {
+                    break;
+                }
+
+                timeout_ms -= static_cast<int>(idle.count());
+            }
+
+            if (wait_ready(timeout_ms)) {
+                last_traffic = Clock::now();
+            }
+        }
+
+        result.clients  = this->clients_.size();
+        result.failed   = this->failed_;
+        result.events   = events.size();
+        result.sent     = this->send_times_.size();
+        result.received = this->received_;
+        result.seconds  = std::chrono::duration<double>(
+                             std::max(last_event, this->last_receive_) -
+                             this->start_)
+                             .count();
+        if (result.seconds > 0.0) {
+            result.throughput =
+                static_cast<double>(result.received) / result.seconds;
+        }
+
+        std::vector<std::uint64_t> &latencies = this->latencies_;
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double fraction) -> std::uint64_t {
+            if (latencies.empty()) {
+                return 0;
+            }
+
+            auto index = static_cast<std::size_t>(
+                fraction * static_cast<double>(latencies.size() - 1));
+            return latencies[index];
+        };
+
+        result.p50_us  = percentile(0.5);
+        result.p90_us  = percentile(0.9);
+        result.p99_us  = percentile(0.99);
+        result.p999_us = percentile(0.999);
+        result.max_us  = percentile(1.0);
+        return result;
+    }
+
+  private:
+    /// Time an event is due, once scaled by the speed factor.
+    Clock::time_point due(const core::SessionEvent &event) const {
+        if (this->options_.speed <= 0.0) {
+            return this->start_;
+        }
+
+        auto offset = std::chrono::duration<double, std::micro>(
+            static_cast<double>(event.time_us) / this->options_.speed);
+        return this->start_ +
+               std::chrono::duration_cast<Clock::duration>(offset);
+    }
+
+    /// Apply an event to one simulated client.
+    void apply(const core::SessionEvent &event, std::size_t index) {
+        SimClient &client = this->clients_[index];
+        switch (event.kind) {
+        case core::SessionEventKind::CONNECT:
+            if (client.sock_fd < 0) {
+                open_client(index);
+            }
+            break;
+        case core::SessionEventKind::MESSAGE:
+            if (client.sock_fd < 0 || client.is_closing) {
+                break;
+            }
+
+            if (is_timed(event.line)) {
+                // The message number goes at the very end, where it
+                // survives being wrapped in "/seq" by reliable channels.
+                client.outbound.append(event.line, 0, event.line.size() - 1);
+                client.outbound += " ~" +
+                                   std::to_string(this->send_times_.size()) +
+                                   "\n";
+                this->send_times_.push_back(Clock::now());
+            } else {
+                client.outbound += event.line;
+            }
+
+            write_client(index);
+            break;
+        case core::SessionEventKind::DISCONNECT:
+            // Without pauses, a client would leave before anything reached
+            // it; every client then stays until the end.
+            if (client.sock_fd >= 0 && this->options_.speed > 0.0) {
+                client.is_closing = true;
+                write_client(index);
+            }
+            break;
+        }
+    }
+
+    /// Connect a simulated client and watch it for input.
+    void open_client(std::size_t index) {
+        SimClient &client = this->clients_[index];
+        client            = SimClient();
+        client.sock_fd    = connect_client(this->options_.port);
+        if (client.sock_fd < 0) {
+            ++this->failed_;
+            return;
+        }
+
+        struct epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u64 = index;
+        ::epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, client.sock_fd, &event);
+    }
+
+    /// Close a simulated client.
+    void close_client(SimClient &client) {
+        ::close(client.sock_fd);
+        client.sock_fd    = -1;
+        client.is_closing = false;
+        client.outbound.clear();
+        client.inbound.clear();
+    }
+
+    /// Send what a client has queued, watching for writability while some
+    /// is left, and close it once a requested disconnection is flushed.
+    void write_client(std::size_t index) {
+        SimClient &client = this->clients_[index];
+        while (!client.outbound.empty()) {
+            ssize_t bytes_sent = ::send(client.sock_fd,
+                                        client.outbound.data(),
+                                        client.outbound.size(),
+                                        MSG_NOSIGNAL);
+            if (bytes_sent < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (bytes_sent < 0 && errno != EAGAIN) {
+                close_client(client);
+                return;
+            }
+
+            if (bytes_sent < 0) {
+                break;
+            }
+
+            client.outbound.erase(0, static_cast<std::size_t>(bytes_sent));
+        }
+
+        if (client.outbound.empty() && client.is_closing) {
+            close_client(client);
+            return;
+        }
+
+        bool is_writing = !client.outbound.empty();
+        if (is_writing != client.is_writing) {
+            struct epoll_event event{};
+            event.events   = EPOLLIN | (is_writing ? EPOLLOUT : 0u);
+            event.data.u64 = index;
+            ::epoll_ctl(
+                this->epoll_fd_, EPOLL_CTL_MOD, client.sock_fd, &event);
+            client.is_writing = is_writing;
+        }
+    }
+
+    /// Read what a client received, timing tagged messages.
+    void read_client(std::size_t index) {
+        SimClient &client = this->clients_[index];
+        char       buffer[65536];
+        ssize_t    bytes_received;
+        do {
+            bytes_received = ::recv(client.sock_fd, buffer, sizeof(buffer), 0);
+        } while (bytes_received < 0 && errno == EINTR);
+
+        if (bytes_received == 0 || (bytes_received < 0 && errno != EAGAIN)) {
+            close_client(client);
+            return;
+        }
+
+        if (bytes_received < 0) {
+            return;
+        }
+
+        Clock::time_point now = Clock::now();
+        this->last_receive_   = now;
+        client.inbound.append(buffer, static_cast<std::size_t>(bytes_received));
+
+        std::string_view rest(client.inbound);
+        std::size_t      newline;
+        while ((newline = rest.find('\n')) != std::string_view::npos) {
+            std::size_t id;
+            if (parse_tag(rest.substr(0, newline), id) &&
+                id < this->send_times_.size()) {
+                this->latencies_.push_back(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        now - this->send_times_[id])
+                        .count()));
+            }
+
+            ++this->received_;
+            rest.remove_prefix(newline + 1);
+        }
+
+        client.inbound.erase(0, client.inbound.size() - rest.size());
+    }
+
+    /// Handle the clients that are ready, waiting up to a timeout.
+    ///
+    /// \return True if any client was ready.
+    bool wait_ready(int timeout_ms) {
+        struct epoll_event events[256];
+        int                ready =
+            ::epoll_wait(this->epoll_fd_, events, 256, timeout_ms);
+        for (int i = 0; i < ready; ++i) {
+            std::size_t index = events[i].data.u64;
+            if (this->clients_[index].sock_fd < 0) {
+                continue;
+            }
+
+            if ((events[i].events & EPOLLOUT) != 0) {
+                write_client(index);
+            }
+
+            if (this->clients_[index].sock_fd >= 0 &&
+                (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+                read_client(index);
+            }
+        }
+
+        return ready > 0;
+    }
+
+    const ReplayOptions           &options_;
+    int                            epoll_fd_;
+    std::vector<SimClient>         clients_;
+    std::vector<Clock::time_point> send_times_;
+    std::vector<std::uint64_t>     latencies_;
+    std::size_t                    failed_   = 0;
+    std::size_t                    received_ = 0;
+    Clock::time_point              start_;
+    Clock::time_point              last_receive_;
+};
+
+/// \brief Print the measurements.
+///
+/// \param speed Speed factor of the replay.
+/// \param result The measurements.
+void print_result(double speed, const ReplayResult &result) {
+    std::printf("[*] Replayed %zu events from %zu clients in %.3fs\n",
+                result.events,
+                result.clients,
+                result.seconds);
+    std::printf("[*] Sent %zu timed messages, received %zu lines "
+                "(%.0f lines/s)\n",
+                result.sent,
+                result.received,
+                result.throughput);
+    std::printf("[*] Latency: p50=%" PRIu64 "us p90=%" PRIu64
+                "us p99=%" PRIu64 "us p999=%" PRIu64 "us max=%" PRIu64 "us\n",
+                result.p50_us,
+                result.p90_us,
+                result.p99_us,
+                result.p999_us,
+                result.max_us);
+    if (result.cpu_time > 0.0) {
+        std::printf("[*] Server used %.3fs of CPU (%.0f lines per CPU "
+                    "second), p99/p50=%.2f\n",
+                    result.cpu_time,
+                    throughput_per_core(result),
+                    tail_ratio(result));
+    }
+
+    if (result.failed > 0) {
+        std::printf("[-] %zu connections failed\n", result.failed);
+    }
+
+    if (speed > 0.0 && result.max_lag_us > 1000) {
+        std::printf("[-] Fell up to %" PRIu64
+                    "us behind the recorded timing\n",
+                    result.max_lag_us);
+    }
+}
+
+/// \brief Write the measurements as a baseline.
+///
+/// Only measurements relative to the machine are written, so that a
+/// baseline stays meaningful on another host.
+///
+/// \param path Output file path.
+/// \param options Replay settings.
+/// \param result The measurements.
+/// \throws std::runtime_error if the file cannot be written.
+void save_baseline(const std::string   &path,
+                   const ReplayOptions &options,
+                   const ReplayResult  &result) {
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error(std::string("fopen: ") + std::strerror(errno));
+    }
+
+    std::fprintf(file,
+                 "# nohub-replay baseline (speed=%g scale=%zu)\n"
+                 "p99_p50_ratio=%.2f\n",
+                 options.speed,
+                 options.scale,
+                 tail_ratio(result));
+    if (result.cpu_time > 0.0) {
+        std::fprintf(
+            file, "throughput_per_core=%.0f\n", throughput_per_core(result));
+    }
+
+    std::fclose(file);
+}
+
+/// \brief Compare the measurements with a baseline.
+///
+/// \param path Baseline file path.
+/// \param tolerance Regression allowed, as a fraction of the baseline.
+/// \param result The measurements.
+/// \return True if no measurement regressed.
+bool compare_baseline(const std::string  &path,
+                      double              tolerance,
+                      const ReplayResult &result) {
+    auto baseline = program::read_config_file(path);
+    if (baseline.empty()) {
+        std::fprintf(
+            stderr, "[-] Baseline %s is empty or missing\n", path.c_str());
+        return false;
+    }
+
+    bool passed = true;
+    auto check  = [&](const char *key, double value, bool higher_is_better) {
+        auto it = baseline.find(key);
+        if (it == baseline.end()) {
+            return;
+        }
+
+        double expected = 0.0;
+        if (!parse_number(std::string_view(it->second), expected)) {
+            std::fprintf(stderr, "[-] Invalid baseline %s\n", key);
+            passed = false;
+            return;
+        }
+
+        bool regressed = higher_is_better
+                             ? value < expected * (1.0 - tolerance)
+                             : value > expected * (1.0 + tolerance);
+        std::printf("[%c] %s: %.2f (baseline %.2f, %+.1f%%)\n",
+                    regressed ? '-' : '+',
+                    key,
+                    value,
+                    expected,
+                    expected > 0.0 ? (value / expected - 1.0) * 100.0 : 0.0);
+        passed = passed && !regressed;
+    };
+
+    // Without the server's CPU time there is nothing to compare the
+    // throughput with.
+    if (result.cpu_time > 0.0) {
+        check("throughput_per_core", throughput_per_core(result), true);
+    }
+
+    check("p99_p50_ratio", tail_ratio(result), false);
+    return passed;
+}
+
+/// \brief Raise the descriptor limit, as every simulated client needs one.
+void raise_fd_limit() {
+    struct rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+
+/// \brief Main entry point for the NoHub replay tool.
+///
+/// \param argc Argument count.
+/// \param argv Argument vector.
+/// \return Exit code.
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--help") == 0 ||
+            std::strcmp(argv[i], "-h") == 0) {
+            print_help(argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    ReplayOptions options;
+    std::string   error_msg = parse_arguments(argc, argv, options);
+    if (!error_msg.empty()) {
+        std::fprintf(stderr, "Error: %s\n", error_msg.c_str());
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    raise_fd_limit();
+
+    pid_t server_pid = -1;
+    bool  passed     = true;
+    try {
+        std::vector<core::SessionEvent> events =
+            core::load_session(options.session_path);
+        if (!options.server_path.empty()) {
+            server_pid = start_server(options);
+        }
+
+        ReplayResult result = Replayer(options).run(events);
+        if (server_pid > 0) {
+            result.cpu_time = stop_server(server_pid);
+            server_pid      = -1;
+        }
+
+        print_result(options.speed, result);
+
+        if (!options.save_baseline_path.empty()) {
+            save_baseline(options.save_baseline_path, options, result);
+        }
+
+        if (!options.baseline_path.empty()) {
+            passed = compare_baseline(
+                options.baseline_path, options.tolerance, result);
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "main: %s\n", e.what());
+        passed = false;
+    }
+
+    if (server_pid > 0) {
+        stop_server(server_pid);
+    }
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}